@@ -49,6 +49,18 @@
 /* XXX: We use fiemap_extent::fe_reserved[0] */
 #define fe_device	fe_reserved[0]
 
+/* fe_device: OST index in the lower 16 bits, absolute stripe number (across
+ * all the layout components) in the upper 16 bits */
+static inline unsigned int get_fe_device(struct fiemap_extent *fe)
+{
+	return fe->fe_device & 0xffff;
+}
+
+static inline unsigned int get_fe_stripenr(struct fiemap_extent *fe)
+{
+	return fe->fe_device >> 16;
+}
+
 static inline size_t fiemap_count_to_size(size_t extent_count)
 {
 	return sizeof(struct fiemap) + extent_count *
@@ -0,0 +1,330 @@
+
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Ugo Varetto
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions inputFile source code must retain the above copyright
+ *notice, this list inputFile conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list inputFile conditions and the following disclaimer in the
+ *documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name inputFile the copyright holder nor the names inputFile
+ *its contributors may be used to endorse or promote products derived from this
+ *software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Checksums for the S3 integrity headers: CRC32C (x-amz-checksum-crc32c)
+// and SHA-256 (x-amz-checksum-sha256, also the SigV4 payload hash).
+// Both are incremental so that data can be hashed chunk by chunk right after
+// each read, while still in cache, instead of re-reading the file.
+// CRC32C uses the SSE4.2 crc32 instruction when compiled with -msse4.2 or
+// -march=native, and a slicing-by-8 table otherwise.
+
+#pragma once
+
+#ifdef __SSE4_2__
+#include <nmmintrin.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+enum class ChecksumType { NONE, CRC32C, SHA256 };
+
+inline ChecksumType ParseChecksumType(const std::string& name) {
+    if (name == "none") return ChecksumType::NONE;
+    if (name == "crc32c") return ChecksumType::CRC32C;
+    if (name == "sha256") return ChecksumType::SHA256;
+    throw std::invalid_argument(
+        "ERROR: checksum must be one of 'none', 'crc32c', 'sha256', " + name +
+        " provided");
+}
+
+// algorithm name as used in x-amz-checksum-algorithm
+inline std::string ChecksumAlgorithm(ChecksumType t) {
+    return t == ChecksumType::CRC32C ? "CRC32C" : "SHA256";
+}
+
+// per-part request header
+inline std::string ChecksumHeader(ChecksumType t) {
+    return t == ChecksumType::CRC32C ? "x-amz-checksum-crc32c"
+                                     : "x-amz-checksum-sha256";
+}
+
+// tag of the part element in CompleteMultipartUpload
+inline std::string ChecksumXMLTag(ChecksumType t) {
+    return "Checksum" + ChecksumAlgorithm(t);
+}
+
+// digest size in bytes
+inline size_t ChecksumSize(ChecksumType t) {
+    return t == ChecksumType::CRC32C ? 4 : t == ChecksumType::SHA256 ? 32 : 0;
+}
+
+//------------------------------------------------------------------------------
+// CRC32C (Castagnoli), reflected polynomial 0x82F63B78
+class CRC32C {
+   public:
+    void Update(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+#ifdef __SSE4_2__
+        uint64_t c = crc_;
+        for (; size >= 8; size -= 8, p += 8) {
+            uint64_t v;
+            std::memcpy(&v, p, 8);
+            c = _mm_crc32_u64(c, v);
+        }
+        uint32_t c32 = uint32_t(c);
+        for (; size > 0; --size) c32 = _mm_crc32_u8(c32, *p++);
+        crc_ = c32;
+#else
+        const auto& t = Table();
+        uint32_t c = crc_;
+        for (; size >= 8; size -= 8, p += 8) {
+            uint32_t lo, hi;
+            std::memcpy(&lo, p, 4);
+            std::memcpy(&hi, p + 4, 4);
+            lo ^= c;  // little endian
+            c = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^
+                t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+                t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^
+                t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+        }
+        for (; size > 0; --size) c = t[0][(c ^ *p++) & 0xFF] ^ (c >> 8);
+        crc_ = c;
+#endif
+    }
+    uint32_t Value() const { return ~crc_; }
+    // big endian, as sent in the header
+    std::string Digest() const {
+        const uint32_t v = Value();
+        const char d[4] = {char(v >> 24), char(v >> 16), char(v >> 8),
+                           char(v)};
+        return std::string(d, 4);
+    }
+
+   private:
+#ifndef __SSE4_2__
+    using Tables = std::array<std::array<uint32_t, 256>, 8>;
+    static const Tables& Table() {
+        static const Tables tables = [] {
+            Tables t;
+            for (uint32_t i = 0; i != 256; ++i) {
+                uint32_t c = i;
+                for (int k = 0; k != 8; ++k)
+                    c = (c >> 1) ^ (0x82F63B78 & (0 - (c & 1)));
+                t[0][i] = c;
+            }
+            for (uint32_t i = 0; i != 256; ++i) {
+                for (int s = 1; s != 8; ++s) {
+                    const uint32_t c = t[s - 1][i];
+                    t[s][i] = (c >> 8) ^ t[0][c & 0xFF];
+                }
+            }
+            return t;
+        }();
+        return tables;
+    }
+#endif
+    uint32_t crc_ = ~0U;
+};
+
+//------------------------------------------------------------------------------
+// SHA-256, FIPS 180-4
+class SHA256 {
+   public:
+    void Update(const void* data, size_t size) {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        length_ += size;
+        if (used_ > 0) {
+            const size_t n = std::min(size, size_t(64) - used_);
+            std::memcpy(block_ + used_, p, n);
+            used_ += n;
+            p += n;
+            size -= n;
+            if (used_ < 64) return;
+            Compress(block_);
+            used_ = 0;
+        }
+        for (; size >= 64; size -= 64, p += 64) Compress(p);
+        std::memcpy(block_, p, size);
+        used_ = size;
+    }
+    std::string Digest() const {
+        SHA256 s = *this;
+        const uint64_t bits = length_ * 8;
+        const uint8_t pad = 0x80;
+        s.Update(&pad, 1);
+        const uint8_t zero[64] = {};
+        s.Update(zero, (s.used_ <= 56 ? 56 : 120) - s.used_);
+        uint8_t len[8];
+        for (int i = 0; i != 8; ++i) len[i] = uint8_t(bits >> (56 - 8 * i));
+        s.Update(len, 8);
+        std::string d(32, '\0');
+        for (int i = 0; i != 8; ++i) {
+            for (int b = 0; b != 4; ++b)
+                d[4 * i + b] = char(s.h_[i] >> (24 - 8 * b));
+        }
+        return d;
+    }
+
+   private:
+    static uint32_t Rot(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+    void Compress(const uint8_t* b) {
+        static const uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b,
+            0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01,
+            0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7,
+            0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+            0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152,
+            0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+            0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+            0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
+            0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08,
+            0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+            0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+            0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+        uint32_t w[64];
+        for (int i = 0; i != 16; ++i) {
+            w[i] = uint32_t(b[4 * i]) << 24 | uint32_t(b[4 * i + 1]) << 16 |
+                   uint32_t(b[4 * i + 2]) << 8 | uint32_t(b[4 * i + 3]);
+        }
+        for (int i = 16; i != 64; ++i) {
+            const uint32_t s0 =
+                Rot(w[i - 15], 7) ^ Rot(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            const uint32_t s1 =
+                Rot(w[i - 2], 17) ^ Rot(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = h_[0], bb = h_[1], c = h_[2], d = h_[3], e = h_[4],
+                 f = h_[5], g = h_[6], h = h_[7];
+        for (int i = 0; i != 64; ++i) {
+            const uint32_t t1 = h + (Rot(e, 6) ^ Rot(e, 11) ^ Rot(e, 25)) +
+                                ((e & f) ^ (~e & g)) + k[i] + w[i];
+            const uint32_t t2 = (Rot(a, 2) ^ Rot(a, 13) ^ Rot(a, 22)) +
+                                ((a & bb) ^ (a & c) ^ (bb & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = bb;
+            bb = a;
+            a = t1 + t2;
+        }
+        h_[0] += a;
+        h_[1] += bb;
+        h_[2] += c;
+        h_[3] += d;
+        h_[4] += e;
+        h_[5] += f;
+        h_[6] += g;
+        h_[7] += h;
+    }
+    uint32_t h_[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                      0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    uint8_t block_[64];
+    size_t used_ = 0;
+    uint64_t length_ = 0;
+};
+
+//------------------------------------------------------------------------------
+// incremental checksum of the selected type, no-op if NONE
+class Checksum {
+   public:
+    explicit Checksum(ChecksumType t = ChecksumType::NONE) : type_(t) {}
+    void Update(const void* data, size_t size) {
+        if (type_ == ChecksumType::CRC32C) crc_.Update(data, size);
+        else if (type_ == ChecksumType::SHA256) sha_.Update(data, size);
+    }
+    // binary digest, empty if NONE
+    std::string Digest() const {
+        return type_ == ChecksumType::CRC32C   ? crc_.Digest()
+               : type_ == ChecksumType::SHA256 ? sha_.Digest()
+                                               : std::string();
+    }
+
+   private:
+    ChecksumType type_;
+    CRC32C crc_;
+    SHA256 sha_;
+};
+
+//------------------------------------------------------------------------------
+inline std::string Base64(const std::string& in) {
+    static const char* chars =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < in.size(); i += 3) {
+        uint32_t v = uint32_t(uint8_t(in[i])) << 16;
+        if (i + 1 < in.size()) v |= uint32_t(uint8_t(in[i + 1])) << 8;
+        if (i + 2 < in.size()) v |= uint8_t(in[i + 2]);
+        out += chars[v >> 18];
+        out += chars[(v >> 12) & 0x3F];
+        out += i + 1 < in.size() ? chars[(v >> 6) & 0x3F] : '=';
+        out += i + 2 < in.size() ? chars[v & 0x3F] : '=';
+    }
+    return out;
+}
+
+inline std::string Hex(const std::string& in) {
+    static const char* digits = "0123456789abcdef";
+    std::string out;
+    for (char c : in) {
+        out += digits[uint8_t(c) >> 4];
+        out += digits[uint8_t(c) & 0xF];
+    }
+    return out;
+}
+
+// empty string if not a valid hex string
+inline std::string FromHex(const std::string& in) {
+    auto nibble = [](char c) {
+        return c >= '0' && c <= '9'   ? c - '0'
+               : c >= 'a' && c <= 'f' ? c - 'a' + 10
+                                      : -1;
+    };
+    std::string out;
+    if (in.size() % 2) return out;
+    for (size_t i = 0; i < in.size(); i += 2) {
+        const int hi = nibble(in[i]);
+        const int lo = nibble(in[i + 1]);
+        if (hi < 0 || lo < 0) return std::string();
+        out += char(hi << 4 | lo);
+    }
+    return out;
+}
+
+// composite checksum of a multipart object as computed by S3: checksum of
+// the concatenated binary part checksums followed by -<number of parts>
+inline std::string CompositeChecksum(ChecksumType t,
+                                     const std::vector<std::string>& parts) {
+    Checksum c(t);
+    for (const auto& p : parts) c.Update(p.data(), p.size());
+    return Base64(c.Digest()) + "-" + std::to_string(parts.size());
+}
@@ -0,0 +1,632 @@
+
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Ugo Varetto
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions inputFile source code must retain the above copyright
+ *notice, this list inputFile conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list inputFile conditions and the following disclaimer in the
+ *documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name inputFile the copyright holder nor the names inputFile
+ *its contributors may be used to endorse or promote products derived from this
+ *software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Mock S3 server on loopback: implements the requests sent by
+// parallel_upload (initiate, upload part and complete multipart upload,
+// single PUT) and parallel_download (HEAD, ranged GET) with configurable
+// latency, bandwidth caps, injected 500/503 errors and throttling (503
+// SlowDown) of requests above a maximum concurrency.
+// Uploaded data is discarded, ETags are computed from the content; GET
+// requests return a synthetic object of configurable size whose content is
+// a function of the offset (MockByte), so downloads can be verified.
+// Part checksums sent in x-amz-checksum-crc32c/sha256 headers are verified
+// and the composite checksum is returned when the upload is completed.
+// Used to measure transfer engine overhead without the network and to
+// exercise retry paths, see upload_bench.sh.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "checksum.h"
+#include "lyra/lyra.hpp"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+struct Config {
+    bool showHelp = false;
+    int port = 9000;
+    int latency = 0;                 // ms added to each request
+    int handshakeLatency = 0;        // ms added to each new connection
+    double connectionBandwidth = 0;  // MiB/s per connection, 0 = no cap
+    double totalBandwidth = 0;       // MiB/s all connections, 0 = no cap
+    double errorRate = 0;            // fraction of requests failing
+    int errorCode = 503;             // 500 or 503
+    size_t objectSize = 1 << 30;     // size of object returned by GET
+    int maxConcurrency = 0;          // requests in flight, 0 = no limit
+};
+
+struct Request {
+    string method;
+    string path;
+    map<string, string> params;
+    map<string, string> headers;  // lowercase keys
+};
+
+struct Stats {
+    atomic<size_t> connections{0};
+    atomic<size_t> requests{0};
+    atomic<size_t> parts{0};
+    atomic<size_t> errors{0};
+    atomic<size_t> bytes{0};  // received
+    atomic<size_t> sent{0};
+    atomic<size_t> badDigests{0};
+    atomic<size_t> throttled{0};
+};
+
+using Clock = chrono::steady_clock;
+
+Stats statsG;
+
+// requests in flight across connections, from request line to response
+atomic<int> inFlightG{0};
+struct InFlight {
+    const int count = ++inFlightG;
+    ~InFlight() { --inFlightG; }
+};
+atomic<bool> stopG{false};
+
+// part checksums of each multipart upload: upload id -> part number ->
+// binary checksum
+mutex checksumMutexG;
+map<string, map<int, string>> partChecksumsG;
+
+// aggregate bandwidth cap: each transfer reserves a time slot on a shared
+// timeline
+mutex pacingMutexG;
+Clock::time_point nextFreeG = Clock::now();
+
+//------------------------------------------------------------------------------
+string ToLower(string s) {
+    transform(begin(s), end(s), begin(s), ::tolower);
+    return s;
+}
+
+bool ReadLine(int sock, string& buffer, string& line) {
+    size_t pos;
+    while ((pos = buffer.find("\r\n")) == string::npos) {
+        char tmp[4096];
+        const ssize_t n = recv(sock, tmp, sizeof(tmp), 0);
+        if (n <= 0) return false;
+        buffer.append(tmp, n);
+    }
+    line = buffer.substr(0, pos);
+    buffer.erase(0, pos + 2);
+    return true;
+}
+
+bool ReadRequest(int sock, string& buffer, Request& req) {
+    string line;
+    if (!ReadLine(sock, buffer, line)) return false;
+    istringstream is(line);
+    string target;
+    is >> req.method >> target;
+    const size_t q = target.find('?');
+    req.path = target.substr(0, q);
+    req.params.clear();
+    if (q != string::npos) {
+        istringstream ps(target.substr(q + 1));
+        string kv;
+        while (getline(ps, kv, '&')) {
+            const size_t e = kv.find('=');
+            req.params[kv.substr(0, e)] =
+                e == string::npos ? "" : kv.substr(e + 1);
+        }
+    }
+    req.headers.clear();
+    while (ReadLine(sock, buffer, line) && !line.empty()) {
+        const size_t c = line.find(':');
+        if (c == string::npos) continue;
+        const size_t v = line.find_first_not_of(' ', c + 1);
+        req.headers[ToLower(line.substr(0, c))] =
+            v == string::npos ? "" : line.substr(v);
+    }
+    return true;
+}
+
+void Pace(const Config& config, size_t bytes, Clock::time_point start,
+          size_t received) {
+    if (config.totalBandwidth > 0) {
+        Clock::time_point slot;
+        {
+            lock_guard<mutex> lock(pacingMutexG);
+            nextFreeG = max(nextFreeG, Clock::now()) +
+                        chrono::duration_cast<Clock::duration>(
+                            chrono::duration<double>(
+                                bytes / (config.totalBandwidth * (1 << 20))));
+            slot = nextFreeG;
+        }
+        this_thread::sleep_until(slot);
+    }
+    if (config.connectionBandwidth > 0) {
+        this_thread::sleep_until(
+            start + chrono::duration_cast<Clock::duration>(
+                        chrono::duration<double>(
+                            received /
+                            (config.connectionBandwidth * (1 << 20)))));
+    }
+}
+
+// FNV-1a
+void Hash(uint64_t& h, const char* data, size_t size) {
+    for (size_t i = 0; i != size; ++i) {
+        h ^= uint8_t(data[i]);
+        h *= 0x100000001b3ULL;
+    }
+}
+
+void Consume(const Config& config, uint64_t& hash, Checksum& checksum,
+             size_t& received, Clock::time_point start, const char* data,
+             size_t size) {
+    Hash(hash, data, size);
+    checksum.Update(data, size);
+    received += size;
+    statsG.bytes += size;
+    Pace(config, size, start, received);
+}
+
+// read request body, Content-Length or chunked encoding
+bool ReadBody(int sock, string& buffer, const Request& req,
+              const Config& config, uint64_t& hash, Checksum& checksum,
+              string* text) {
+    const auto start = Clock::now();
+    size_t received = 0;
+    char tmp[1 << 16];
+    auto readN = [&](size_t n) {
+        while (n > 0) {
+            if (buffer.empty()) {
+                const ssize_t r = recv(sock, tmp, min(n, sizeof(tmp)), 0);
+                if (r <= 0) return false;
+                if (text) text->append(tmp, r);
+                Consume(config, hash, checksum, received, start, tmp, r);
+                n -= r;
+            } else {
+                const size_t b = min(n, buffer.size());
+                if (text) text->append(buffer, 0, b);
+                Consume(config, hash, checksum, received, start,
+                        buffer.data(), b);
+                buffer.erase(0, b);
+                n -= b;
+            }
+        }
+        return true;
+    };
+    auto te = req.headers.find("transfer-encoding");
+    if (te != req.headers.end() && ToLower(te->second) == "chunked") {
+        string line;
+        while (ReadLine(sock, buffer, line)) {
+            const size_t n = stoul(line, nullptr, 16);
+            if (n == 0) return ReadLine(sock, buffer, line);  // trailer
+            if (!readN(n) || !ReadLine(sock, buffer, line)) return false;
+        }
+        return false;
+    }
+    auto cl = req.headers.find("content-length");
+    return cl == req.headers.end() || readN(stoull(cl->second));
+}
+
+bool Send(int sock, const char* data, size_t size) {
+    size_t sent = 0;
+    while (sent < size) {
+        const ssize_t n = send(sock, data + sent, size - sent, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        sent += n;
+    }
+    return true;
+}
+
+bool Send(int sock, const string& s) { return Send(sock, s.data(), s.size()); }
+
+bool SendResponse(int sock, int status, const string& body,
+                  const map<string, string>& headers = {}) {
+    const char* reason = status == 200   ? "OK"
+                         : status == 500 ? "Internal Server Error"
+                         : status == 503 ? "Service Unavailable"
+                         : status == 416 ? "Range Not Satisfiable"
+                                         : "Bad Request";
+    string r = "HTTP/1.1 " + to_string(status) + " " + reason + "\r\n";
+    for (const auto& kv : headers) r += kv.first + ": " + kv.second + "\r\n";
+    r += "Content-Length: " + to_string(body.size()) + "\r\n";
+    r += "Content-Type: application/xml\r\n\r\n" + body;
+    return Send(sock, r);
+}
+
+// content of synthetic object
+inline char MockByte(size_t offset) {
+    return char((offset * 2654435761ULL) >> 13);
+}
+
+// send [first, last] of synthetic object
+bool SendObject(int sock, const Config& config, int status, size_t first,
+                size_t last, bool head) {
+    string r = "HTTP/1.1 " + to_string(status) +
+               (status == 206 ? " Partial Content\r\n" : " OK\r\n");
+    r += "Content-Length: " + to_string(last + 1 - first) + "\r\n";
+    if (status == 206) {
+        r += "Content-Range: bytes " + to_string(first) + "-" +
+             to_string(last) + "/" + to_string(config.objectSize) + "\r\n";
+    }
+    r += "ETag: \"mock\"\r\nContent-Type: application/octet-stream\r\n\r\n";
+    if (!Send(sock, r.data(), r.size())) return false;
+    if (head) return true;
+    const auto start = Clock::now();
+    vector<char> buffer(1 << 16);
+    size_t sent = 0;
+    for (size_t o = first; o <= last; o += buffer.size()) {
+        const size_t n = min(buffer.size(), last + 1 - o);
+        for (size_t i = 0; i != n; ++i) buffer[i] = MockByte(o + i);
+        if (!Send(sock, buffer.data(), n)) return false;
+        sent += n;
+        statsG.sent += n;
+        Pace(config, n, start, sent);
+    }
+    return true;
+}
+
+// parse single range "bytes=<first>-[<last>]" or "bytes=-<suffix length>"
+// of an object of 'size' bytes; returns 206 on success, 416 if the range is
+// not satisfiable, 400 if it is malformed
+int ParseRange(const string& range, size_t size, size_t& first,
+               size_t& last) {
+    if (range.compare(0, 6, "bytes=") != 0) return 400;
+    const string spec = range.substr(6);
+    const size_t dash = spec.find('-');
+    if (dash == string::npos) return 400;
+    // strtoull accepts leading blanks and signs: require digits only
+    auto number = [](const string& s, size_t& n) {
+        if (s.empty() || s.find_first_not_of("0123456789") != string::npos)
+            return false;
+        char* end = nullptr;
+        errno = 0;
+        n = strtoull(s.c_str(), &end, 10);
+        return errno == 0 && *end == '\0';
+    };
+    const string a = spec.substr(0, dash);
+    const string b = spec.substr(dash + 1);
+    size_t n = 0;
+    if (a.empty()) {
+        // suffix: last n bytes
+        if (!number(b, n)) return 400;
+        if (n == 0 || size == 0) return 416;
+        first = size > n ? size - n : 0;
+        last = size - 1;
+        return 206;
+    }
+    if (!number(a, first)) return 400;
+    last = size - 1;
+    if (!b.empty()) {
+        if (!number(b, n) || n < first) return 400;
+        last = min(last, n);
+    }
+    return first < size ? 206 : 416;
+}
+
+string HexETag(uint64_t h) {
+    ostringstream os;
+    os << '"' << hex << h << '"';
+    return os.str();
+}
+
+//------------------------------------------------------------------------------
+// one thread per connection, requests on the same connection handled in
+// sequence (keep-alive)
+void Serve(int sock, const Config& config) {
+    thread_local mt19937 gen(random_device{}());
+    uniform_real_distribution<double> coin(0, 1);
+    statsG.connections += 1;
+    // TCP/TLS handshake round trips
+    if (config.handshakeLatency > 0) {
+        this_thread::sleep_for(chrono::milliseconds(config.handshakeLatency));
+    }
+    string buffer;
+    Request req;
+    // malformed requests (e.g. invalid chunk size or Content-Length) are
+    // answered with 400 and the connection is closed: the rest of the
+    // stream cannot be parsed
+    try {
+        while (!stopG && ReadRequest(sock, buffer, req)) {
+            statsG.requests += 1;
+            // concurrency at arrival, the request is throttled after the body
+            // is read
+            const InFlight inFlight;
+            const bool throttle = config.maxConcurrency > 0 &&
+                                  inFlight.count > config.maxConcurrency;
+            auto ex = req.headers.find("expect");
+            if (ex != req.headers.end() &&
+                ToLower(ex->second) == "100-continue" &&
+                !Send(sock, "HTTP/1.1 100 Continue\r\n\r\n"))
+                break;
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            string text;
+            const bool complete =
+                req.method == "POST" && req.params.count("uploadId");
+            ChecksumType checksumType = ChecksumType::NONE;
+            string expected;  // base64 checksum header
+            for (ChecksumType t :
+                 {ChecksumType::CRC32C, ChecksumType::SHA256}) {
+                auto h = req.headers.find(ChecksumHeader(t));
+                if (h == req.headers.end()) continue;
+                checksumType = t;
+                expected = h->second;
+            }
+            Checksum checksum(checksumType);
+            if (!ReadBody(sock, buffer, req, config, hash, checksum,
+                          complete ? &text : nullptr))
+                break;
+            if (config.latency > 0) {
+                this_thread::sleep_for(chrono::milliseconds(config.latency));
+            }
+            if (throttle) {
+                statsG.throttled += 1;
+                if (!SendResponse(sock, 503,
+                                  "<Error><Code>SlowDown</Code></Error>"))
+                    break;
+                continue;
+            }
+            if (config.errorRate > 0 && coin(gen) < config.errorRate) {
+                statsG.errors += 1;
+                const string code = config.errorCode == 500 ? "InternalError"
+                                                            : "SlowDown";
+                if (!SendResponse(sock, config.errorCode,
+                                  "<Error><Code>" + code + "</Code></Error>"))
+                    break;
+                continue;
+            }
+            bool ok = true;
+            const string digest = checksum.Digest();
+            if (!expected.empty() && Base64(digest) != expected) {
+                statsG.badDigests += 1;
+                ok = SendResponse(sock, 400,
+                                  "<Error><Code>BadDigest</Code></Error>");
+            } else if (req.method == "POST" && req.params.count("uploads")) {
+                // initiate multipart upload
+                static atomic<int> uploadCount{0};
+                const string id = "mock" + to_string(uploadCount++);
+                ok = SendResponse(
+                    sock, 200,
+                    "<InitiateMultipartUploadResult><UploadId>" + id +
+                        "</UploadId></InitiateMultipartUploadResult>");
+            } else if (complete) {
+                // complete multipart upload
+                size_t numParts = 0;
+                for (size_t p = text.find("<Part>"); p != string::npos;
+                     p = text.find("<Part>", p + 1))
+                    ++numParts;
+                map<int, string> partChecksums;
+                {
+                    lock_guard<mutex> lock(checksumMutexG);
+                    auto u = partChecksumsG.find(req.params["uploadId"]);
+                    if (u != partChecksumsG.end()) {
+                        partChecksums = u->second;
+                        partChecksumsG.erase(u);
+                    }
+                }
+                // checksums in the request must match the ones of the parts
+                string composite;
+                if (!partChecksums.empty()) {
+                    const size_t size = partChecksums.begin()->second.size();
+                    const ChecksumType t =
+                        size == ChecksumSize(ChecksumType::CRC32C)
+                            ? ChecksumType::CRC32C
+                            : ChecksumType::SHA256;
+                    const string tag = ChecksumXMLTag(t);
+                    vector<string> digests;
+                    for (const auto& kv : partChecksums) {
+                        digests.push_back(kv.second);
+                        if (text.find("<" + tag + ">" + Base64(kv.second) +
+                                      "</" + tag + ">") == string::npos)
+                            composite = "invalid";
+                    }
+                    if (composite.empty()) {
+                        composite = "<" + tag + ">" +
+                                    CompositeChecksum(t, digests) + "</" + tag +
+                                    ">";
+                    }
+                }
+                if (composite == "invalid") {
+                    ok = SendResponse(
+                        sock, 400, "<Error><Code>InvalidPart</Code></Error>");
+                } else {
+                    ok = SendResponse(
+                        sock, 200,
+                        "<CompleteMultipartUploadResult><ETag>" +
+                            HexETag(hash) + "-" + to_string(numParts) +
+                            "</ETag>" + composite +
+                            "</CompleteMultipartUploadResult>");
+                }
+            } else if (req.method == "GET" || req.method == "HEAD") {
+                // whole or ranged read of synthetic object
+                size_t first = 0;
+                size_t last = config.objectSize - 1;
+                int status = 200;
+                auto range = req.headers.find("range");
+                if (range != req.headers.end()) {
+                    status = ParseRange(range->second, config.objectSize,
+                                        first, last);
+                }
+                if (status == 416) {
+                    ok = SendResponse(
+                        sock, 416, "<Error><Code>InvalidRange</Code></Error>",
+                        {{"Content-Range",
+                          "bytes */" + to_string(config.objectSize)}});
+                } else if (status == 400) {
+                    ok = SendResponse(
+                        sock, 400,
+                        "<Error><Code>InvalidArgument</Code></Error>");
+                } else {
+                    ok = SendObject(sock, config, status, first, last,
+                                    req.method == "HEAD");
+                }
+            } else if (req.method == "PUT") {
+                // upload part or single object
+                map<string, string> headers = {{"ETag", HexETag(hash)}};
+                if (req.params.count("partNumber")) {
+                    statsG.parts += 1;
+                    if (checksumType != ChecksumType::NONE) {
+                        lock_guard<mutex> lock(checksumMutexG);
+                        partChecksumsG[req.params["uploadId"]]
+                                      [stoi(req.params["partNumber"])] = digest;
+                    }
+                }
+                if (checksumType != ChecksumType::NONE) {
+                    headers[ChecksumHeader(checksumType)] = expected;
+                }
+                ok = SendResponse(sock, 200, "", headers);
+            } else {
+                ok = SendResponse(sock, 400,
+                                  "<Error><Code>NotImplemented</Code></Error>");
+            }
+            if (!ok) break;
+            auto conn = req.headers.find("connection");
+            if (conn != req.headers.end() && ToLower(conn->second) == "close")
+                break;
+        }
+    } catch (const exception&) {
+        SendResponse(sock, 400, "<Error><Code>BadRequest</Code></Error>",
+                     {{"Connection", "close"}});
+    }
+    close(sock);
+}
+
+void Stop(int) { stopG = true; }
+
+//------------------------------------------------------------------------------
+int main(int argc, char const* argv[]) {
+    try {
+        Config config;
+        auto cli =
+            lyra::help(config.showHelp)
+                .description("Mock S3 server listening on 127.0.0.1") |
+            lyra::opt(config.port, "port")["-p"]["--port"]("Port").optional() |
+            lyra::opt(config.latency, "latency")["-l"]["--latency"](
+                "Latency added to each request in ms")
+                .optional() |
+            lyra::opt(config.handshakeLatency,
+                      "latency")["-H"]["--handshake-latency"](
+                "Latency added to each new connection in ms")
+                .optional() |
+            lyra::opt(config.connectionBandwidth,
+                      "bandwidth")["-c"]["--connection-bandwidth"](
+                "Per connection bandwidth cap in MiB/s")
+                .optional() |
+            lyra::opt(config.totalBandwidth, "bandwidth")["-b"]["--bandwidth"](
+                "Aggregate bandwidth cap in MiB/s")
+                .optional() |
+            lyra::opt(config.errorRate, "error rate")["-e"]["--error-rate"](
+                "Fraction of requests answered with an error")
+                .optional() |
+            lyra::opt(config.errorCode, "error code")["-s"]["--status"](
+                "Injected error status code")
+                .choices(500, 503)
+                .optional() |
+            lyra::opt(config.objectSize, "size")["-z"]["--object-size"](
+                "Size of object returned by GET requests")
+                .optional() |
+            lyra::opt(config.maxConcurrency, "requests")["-t"]["--throttle"](
+                "Reply 503 SlowDown to requests above this concurrency")
+                .optional();
+        auto result = cli.parse({argc, argv});
+        if (!result) {
+            cerr << result.errorMessage() << endl;
+            cerr << cli << endl;
+            exit(1);
+        }
+        if (config.showHelp) {
+            cout << cli;
+            return 0;
+        }
+        if (config.errorRate < 0 || config.errorRate >= 1) {
+            throw invalid_argument("ERROR: error rate must be in [0, 1)");
+        }
+        const int server = socket(AF_INET, SOCK_STREAM, 0);
+        if (server < 0) throw runtime_error("Cannot create socket");
+        const int one = 1;
+        setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(config.port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (::bind(server, (sockaddr*)&addr, sizeof(addr)) ||
+            listen(server, 128)) {
+            throw runtime_error("Cannot listen on port " +
+                                to_string(config.port) + ": " +
+                                strerror(errno));
+        }
+        // no SA_RESTART: accept returns on signal
+        struct sigaction sa = {};
+        sa.sa_handler = Stop;
+        sigaction(SIGINT, &sa, nullptr);
+        sigaction(SIGTERM, &sa, nullptr);
+        cout << "Listening on 127.0.0.1:" << config.port << endl;
+        while (!stopG) {
+            const int sock = accept(server, nullptr, nullptr);
+            if (sock < 0) continue;
+            setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            thread(Serve, sock, cref(config)).detach();
+        }
+        close(server);
+        cout << "Connections: " << statsG.connections << endl
+             << "Requests:    " << statsG.requests << endl
+             << "Parts:       " << statsG.parts << endl
+             << "Errors:      " << statsG.errors << endl
+             << "Received:    " << statsG.bytes << endl
+             << "Sent:        " << statsG.sent << endl
+             << "Bad digests: " << statsG.badDigests << endl
+             << "Throttled:   " << statsG.throttled << endl;
+        return 0;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,445 @@
+
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Ugo Varetto
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions inputFile source code must retain the above copyright
+ *notice, this list inputFile conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list inputFile conditions and the following disclaimer in the
+ *documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name inputFile the copyright holder nor the names inputFile
+ *its contributors may be used to endorse or promote products derived from this
+ *software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Parallel file download from S3 servers: the object is split into parts
+// fetched with concurrent ranged GET requests into a bounded pool of
+// buffers; writer threads store each part with pwrite at its offset and
+// return the buffer to the pool.
+// Compile with -DLUSTRE_LAYOUT and link to lustreapi to create the
+// destination with a chosen stripe layout and align parts to it, so that
+// concurrent writes map onto different OSTs.
+
+#include <aws_sign.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include "lyra/lyra.hpp"
+#include "response_parser.h"
+#include "s3_transfer.h"
+#include "utility.h"
+#include "webclient.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+struct Config {
+    bool showHelp = false;
+    string s3AccessKey;
+    string s3SecretKey;
+    string endpoint;
+    string bucket;
+    string key;
+    string file;
+    string credentials;
+    string awsProfile;
+    int maxRetries = 2;
+    int jobs = 1;        // concurrent GET requests
+    int writeJobs = -1;  // -1 = same as jobs
+    size_t partSize = 1 << 26;
+    int numBuffers = -1;  // -1 = 2 x jobs
+    // destination layout, 0 = filesystem default
+    uint64_t stripeSize = 0;
+    uint64_t stripeCount = 0;
+};
+
+void Validate(const Config& config) {
+    if (config.s3AccessKey.empty() && !config.s3SecretKey.empty() ||
+        config.s3SecretKey.empty() && !config.s3AccessKey.empty()) {
+        throw invalid_argument(
+            "ERROR: both access and secret keys have to be specified");
+    }
+    if (config.jobs < 1) {
+        throw invalid_argument(
+            "ERROR: number of jobs must be greater than one, " +
+            to_string(config.jobs) + " provided");
+    }
+    if (config.partSize < MIN_PART_SIZE || config.partSize > MAX_PART_SIZE) {
+        throw invalid_argument(
+            "ERROR: part size must be in range [5 MiB, 5 GiB], " +
+            to_string(config.partSize) + " provided");
+    }
+    if (config.maxRetries < 1) {
+        throw invalid_argument(
+            "ERROR: number of retries must be greater than one, " +
+            to_string(config.maxRetries) + " provided");
+    }
+#ifndef LUSTRE_LAYOUT
+    if (config.stripeSize || config.stripeCount) {
+        throw invalid_argument(
+            "ERROR: stripe options require compilation with LUSTRE_LAYOUT");
+    }
+#endif
+}
+
+using Headers = map<string, string>;
+
+atomic<int> numRetriesG{0};
+
+WebClient BuildRequest(const Config& config, const string& path,
+                       const string& method, const Headers& extra = {}) {
+    auto signedHeaders =
+        SignHeaders(config.s3AccessKey, config.s3SecretKey, config.endpoint,
+                    method, config.bucket, config.key, "");
+    Headers headers(begin(signedHeaders), end(signedHeaders));
+    headers.insert(begin(extra), end(extra));
+    WebClient req(config.endpoint, path, method, {}, headers);
+    req.SetMethod(method);
+    return req;
+}
+
+size_t ObjectSize(const Config& config, const string& path) {
+    string error;
+    for (int tryNum = 1; tryNum <= config.maxRetries; ++tryNum) {
+        if (tryNum > 1) {
+            numRetriesG += 1;
+            Backoff(tryNum - 1);
+        }
+        WebClient req = BuildRequest(config, path, "HEAD");
+        if (!req.Send()) {
+            error = "Error sending request: " + req.ErrorMsg();
+            continue;
+        }
+        if (req.StatusCode() >= 400) {
+            error = "Error retrieving object size - HTTP status " +
+                    to_string(req.StatusCode());
+            continue;
+        }
+        const string length =
+            HTTPHeader(req.GetHeaderText(), "[Cc]ontent-[Ll]ength");
+        if (length.empty()) {
+            throw runtime_error("No Content-Length found in HTTP header");
+        }
+        return stoull(length);
+    }
+    throw runtime_error(error);
+}
+
+// create destination file with requested layout and set its size; the file
+// must not exist, as with llapi_layout_file_create which cannot change the
+// layout of an existing file
+void CreateDestination(const Config& config, size_t size) {
+    int fd = -1;
+#ifdef LUSTRE_LAYOUT
+    if (config.stripeSize || config.stripeCount) {
+        llapi_layout* layout = llapi_layout_alloc();
+        if (!layout ||
+            config.stripeSize &&
+                llapi_layout_stripe_size_set(layout, config.stripeSize) ||
+            config.stripeCount &&
+                llapi_layout_stripe_count_set(layout, config.stripeCount)) {
+            throw runtime_error(string("Error setting layout attributes: ") +
+                                strerror(errno));
+        }
+        fd = llapi_layout_file_create(config.file.c_str(), O_WRONLY, 0644,
+                                      layout);
+        llapi_layout_free(layout);
+    } else
+#endif
+    {
+        fd = open(config.file.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+    }
+    if (fd < 0 && errno == EEXIST) {
+        throw runtime_error("Destination file " + config.file +
+                            " already exists, remove it first");
+    }
+    if (fd < 0) {
+        throw runtime_error("Cannot create file " + config.file + ": " +
+                            strerror(errno));
+    }
+    if (ftruncate(fd, size)) {
+        const string error = strerror(errno);
+        close(fd);
+        throw runtime_error("Error setting file size: " + error);
+    }
+    if (close(fd)) throw runtime_error("Error closing output file");
+}
+
+//------------------------------------------------------------------------------
+// receives the body of a ranged GET into a part buffer
+struct RangeBuffer {
+    char* data = nullptr;
+    size_t size = 0;
+    size_t received = 0;
+};
+
+size_t WriteRange(char* ptr, size_t size, size_t nmemb, void* userData) {
+    RangeBuffer* rb = static_cast<RangeBuffer*>(userData);
+    const size_t n = size * nmemb;
+    if (rb->received + n > rb->size) return 0;  // abort transfer
+    memcpy(rb->data + rb->received, ptr, n);
+    rb->received += n;
+    return n;
+}
+
+// download [offset, offset + size) into dest, retrying up to maxTries times
+void DownloadPart(const Config& config, const string& path, int i,
+                  size_t offset, size_t size, char* dest, int maxTries) {
+    string error;
+    for (int tryNum = 1; tryNum <= maxTries; ++tryNum) {
+        if (tryNum > 1) {
+            numRetriesG += 1;
+            Backoff(tryNum - 1);
+        }
+        const string range = "bytes=" + to_string(offset) + "-" +
+                             to_string(offset + size - 1);
+        WebClient req = BuildRequest(config, path, "GET", {{"Range", range}});
+        RangeBuffer rb{dest, size, 0};
+        req.SetWriteFunction(WriteRange, &rb);
+        if (!req.Send()) {
+            error = "Cannot download part " + to_string(i + 1) + " " +
+                    req.ErrorMsg();
+            continue;
+        }
+        if (req.StatusCode() != 206 && req.StatusCode() != 200) {
+            error = "Error downloading part " + to_string(i + 1) +
+                    " - HTTP status " + to_string(req.StatusCode());
+            continue;
+        }
+        if (rb.received == size) return;
+        error = "Short read, part " + to_string(i + 1);
+    }
+    throw runtime_error(error);
+}
+
+//------------------------------------------------------------------------------
+// Downloader threads fetch parts into a fixed pool of buffers, writer
+// threads store them and return the buffers to the pool; downloaders block
+// when no buffer is free, so the network never runs ahead of the file
+// system by more than the number of buffers.
+struct DownloadState {
+    PartQueue& parts;
+    BlockingQueue<char*> freeBuffers;
+    BlockingQueue<Part> readyParts;
+    explicit DownloadState(PartQueue& p) : parts(p) {}
+};
+
+void Download(const Config& config, const string& path,
+              DownloadState& state) {
+    PartQueue& parts = state.parts;
+    for (int i = parts.Next(); i >= 0; i = parts.Next()) {
+        Part p;
+        p.index = i;
+        p.size = parts.Size(i);
+        state.freeBuffers.Pop(p.data);  // back-pressure
+        auto start = chrono::high_resolution_clock::now();
+        try {
+            DownloadPart(config, path, i, parts.Offset(i), p.size, p.data,
+                         config.maxRetries);
+        } catch (...) {
+            parts.etags[i].set_exception(current_exception());
+            state.freeBuffers.Push(p.data);
+            continue;
+        }
+        auto end = chrono::high_resolution_clock::now();
+        parts.seconds[i] = chrono::duration<float>(end - start).count();
+        state.readyParts.Push(p);
+    }
+}
+
+// opened before any thread is started: a writer which failed to open the
+// file would leave ready parts undrained and downloaders blocked on buffers
+int OpenOutput(const Config& config) {
+    const int fd = open(config.file.c_str(), O_WRONLY | O_LARGEFILE);
+    if (fd < 0) {
+        throw runtime_error("Cannot open output file " + config.file + ": " +
+                            strerror(errno));
+    }
+    return fd;
+}
+
+// write ready parts to fd, closes fd
+void Write(int fd, DownloadState& state) {
+    Part p;
+    while (state.readyParts.Pop(p)) {
+        const size_t offset = state.parts.Offset(p.index);
+        size_t written = 0;
+        while (written < p.size) {
+            const ssize_t n = pwrite(fd, p.data + written, p.size - written,
+                                     offset + written);
+            if (n <= 0) break;
+            written += n;
+        }
+        if (written == p.size) {
+            state.parts.etags[p.index].set_value("");
+        } else {
+            state.parts.etags[p.index].set_exception(
+                make_exception_ptr(runtime_error(
+                    "Error writing part " + to_string(p.index + 1) + ": " +
+                    strerror(errno))));
+        }
+        state.freeBuffers.Push(p.data);
+    }
+    if (fsync(fd) || close(fd)) {
+        throw runtime_error("Error closing output file");
+    }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char const* argv[]) {
+    try {
+        Config config;
+        auto cli =
+            lyra::help(config.showHelp)
+                .description("Download S3 object to file, the destination "
+                             "file must not exist") |
+            lyra::opt(config.s3AccessKey,
+                      "awsAccessKey")["-a"]["--access_key"]("AWS access key")
+                .optional() |
+            lyra::opt(config.s3SecretKey,
+                      "awsSecretKey")["-s"]["--secret_key"]("AWS secret key")
+                .optional() |
+            lyra::opt(config.endpoint,
+                      "endpoint")["-e"]["--endpoint"]("Endpoint URL")
+                .required() |
+            lyra::opt(config.bucket, "bucket")["-b"]["--bucket"]("Bucket name")
+                .required() |
+            lyra::opt(config.key, "key")["-k"]["--key"]("Key name").required() |
+            lyra::opt(config.file, "file")["-f"]["--file"](
+                "File name, must not exist")
+                .required() |
+            lyra::opt(config.jobs, "parallel jobs")["-j"]["--jobs"](
+                "Number of concurrent requests")
+                .optional() |
+            lyra::opt(config.writeJobs, "write jobs")["-w"]["--write-jobs"](
+                "Number of threads writing to file")
+                .optional() |
+            lyra::opt(config.credentials,
+                      "credentials file")["-c"]["--credentials"](
+                "Credentials file, AWS cli format")
+                .optional() |
+            lyra::opt(config.awsProfile,
+                      "AWS config profile")["-p"]["--profile"](
+                "Profile in AWS config file")
+                .optional() |
+            lyra::opt(config.maxRetries, "Max retries")["-r"]["--retries"](
+                "Max number of per-part retries")
+                .optional() |
+            lyra::opt(config.partSize, "part size")["-P"]["--part-size"](
+                "Part size, default 64 MiB")
+                .optional() |
+            lyra::opt(config.numBuffers, "buffers")["-B"]["--buffers"](
+                "Number of part buffers")
+                .optional() |
+            lyra::opt(config.stripeSize, "stripe size")["-S"]["--stripe-size"](
+                "Destination stripe size")
+                .optional() |
+            lyra::opt(config.stripeCount,
+                      "stripe count")["-C"]["--stripe-count"](
+                "Destination stripe count")
+                .optional();
+
+        auto result = cli.parse({argc, argv});
+        if (!result) {
+            cerr << result.errorMessage() << endl;
+            cerr << cli << endl;
+            exit(1);
+        }
+        if (config.showHelp) {
+            cout << cli;
+            return 0;
+        }
+        InitConfig(config);
+        Validate(config);
+        const string path = "/" + config.bucket + "/" + config.key;
+        const size_t objectSize = ObjectSize(config, path);
+        if (objectSize == 0) {
+            CreateDestination(config, 0);
+            return 0;
+        }
+        CreateDestination(config, objectSize);
+        // parts aligned to the actual destination layout
+        const StripeLayout stripes = GetStripeLayout(config.file);
+        if (stripes.stripeSize > 0) {
+            cout << "Stripe size: " << stripes.stripeSize
+                 << ", stripe count: " << stripes.stripeCount << endl;
+        }
+        PartQueue parts(objectSize,
+                        PartSize(config.partSize, objectSize, stripes),
+                        stripes);
+        PrintStartStripes(parts, config.jobs);
+        vector<future<string>> status = parts.Futures();
+        DownloadState state(parts);
+        const int writeJobs =
+            config.writeJobs > 0 ? config.writeJobs : config.jobs;
+        const int numBuffers =
+            config.numBuffers > 0 ? config.numBuffers : 2 * config.jobs;
+        vector<char> buffers(numBuffers * parts.partSize);
+        for (int b = 0; b != numBuffers; ++b) {
+            state.freeBuffers.Push(buffers.data() + b * parts.partSize);
+        }
+        vector<int> fds;
+        try {
+            for (int w = 0; w != writeJobs; ++w) {
+                fds.push_back(OpenOutput(config));
+            }
+        } catch (...) {
+            for (int fd : fds) close(fd);
+            throw;
+        }
+        auto start = chrono::high_resolution_clock::now();
+        vector<future<void>> downloaders(config.jobs);
+        for (auto& d : downloaders) {
+            d = async(launch::async, Download, cref(config), cref(path),
+                      ref(state));
+        }
+        vector<future<void>> writers(writeJobs);
+        for (int w = 0; w != writeJobs; ++w) {
+            writers[w] = async(launch::async, Write, fds[w], ref(state));
+        }
+        for (auto& d : downloaders) d.get();
+        state.readyParts.Close();
+        for (auto& w : writers) w.get();
+        auto end = chrono::high_resolution_clock::now();
+        for (auto& s : status) s.get();  // rethrows first part error
+        const float seconds = chrono::duration<float>(end - start).count();
+        cout << "Parts: " << parts.numParts << " x " << parts.partSize
+             << " bytes" << endl;
+        PrintPartTimes("download", parts.seconds);
+        cout << "Bandwidth: " << objectSize / seconds / (1 << 30) << " GiB/s"
+             << endl;
+        if (numRetriesG > 0) cout << "Num retries: " << numRetriesG << endl;
+        return 0;
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+}
@@ -33,22 +33,38 @@
  ******************************************************************************/
 
 // Parallel file upload to S3 servers
+// Compile with -DLUSTRE_LAYOUT and link to lustreapi to align part
+// boundaries to the Lustre stripe layout.
 
 #include <aws_sign.h>
+#include <dirent.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <chrono>
+#include <cstring>
+#include <fstream>
 #include <future>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <regex>
+#include <sstream>
 #include <set>
 #include <stdexcept>
 #include <vector>
 
 #include "lyra/lyra.hpp"
+#include "checksum.h"
 #include "response_parser.h"
+#include "s3_transfer.h"
 #include "utility.h"
 #include "webclient.h"
 
@@ -63,18 +79,43 @@ struct Config {
     string bucket;
     string key;
     string file;
+    // upload all files under directory, key is used as prefix
+    string dir;
     string credentials;
     string awsProfile;
     int maxRetries = 2;
     int jobs = 1;
     string memoryMapping = "none";
-    // when pre-loading data the number of threads used to load data
+    // when streaming data the number of threads used to load data
     // can be different from the number of threads used to send data
-    // int loadJobs = -1;
-    // int dataTransferJobs = -1;
+    int loadJobs = -1;  // -1 = same as jobs
+    // multipart upload part size, independent of number of jobs
+    size_t partSize = 1 << 26;
+    // streaming: number of part buffers, memory usage is
+    // partSize x numBuffers independent of file size
+    int numBuffers = -1;  // -1 = 2 x jobs
+    // new connection for each request instead of one per worker
+    bool noKeepAlive = false;
+    // part journal, default: <file>.upload_journal
+    string journal;
+    // upload only the parts missing from the journal
+    bool resume = false;
+    // per-part integrity header: none, crc32c or sha256
+    string checksum = "none";
+    // adapt the number of parts in flight, up to 'jobs'
+    bool adaptive = false;
 };
 
 void Validate(const Config& config) {
+    if (config.file.empty() == config.dir.empty()) {
+        throw invalid_argument(
+            "ERROR: one of file or directory has to be specified");
+    }
+    if (!config.dir.empty() &&
+        (config.memoryMapping != "none" || config.resume)) {
+        throw invalid_argument(
+            "ERROR: memory mapping and resume not supported with directories");
+    }
     if (config.s3AccessKey.empty() && !config.s3SecretKey.empty() ||
         config.s3SecretKey.empty() && !config.s3AccessKey.empty()) {
         throw invalid_argument(
@@ -85,6 +126,16 @@ void Validate(const Config& config) {
             "ERROR: number of jobs must be greater than one, " +
             to_string(config.jobs) + " provided");
     }
+    if (config.partSize < MIN_PART_SIZE || config.partSize > MAX_PART_SIZE) {
+        throw invalid_argument(
+            "ERROR: part size must be in range [5 MiB, 5 GiB], " +
+            to_string(config.partSize) + " provided");
+    }
+    if (ParseChecksumType(config.checksum) != ChecksumType::NONE &&
+        config.jobs < 2 && config.dir.empty()) {
+        throw invalid_argument(
+            "ERROR: checksums only supported with multipart uploads (-j > 1)");
+    }
     if (config.maxRetries < 1) {
         throw invalid_argument(
             "ERROR: number of retries must be greater than one, " +
@@ -113,20 +164,108 @@ using Headers = map<string, string>;
 using Parameters = map<string, string>;
 
 atomic<int> numRetriesG{0};
+atomic<int> numRequestsG{0};     // part upload requests
+atomic<int> numClientsG{0};      // clients created
 
-WebClient BuildUploadRequest(const Config& config, const string& path,
-                             int partNum, const string& uploadId) {
-    Parameters params = {{"partNumber", to_string(partNum + 1)},
-                         {"uploadId", uploadId}};
-    auto signedHeaders =
-        SignHeaders(config.s3AccessKey, config.s3SecretKey, config.endpoint,
-                    "PUT", config.bucket, config.key, "", params);
-    Headers headers(begin(signedHeaders), end(signedHeaders));
-    WebClient req(config.endpoint, path, "PUT", params, headers);
-    return req;
+//------------------------------------------------------------------------------
+// Per-worker connection: the same WebClient, and therefore the same HTTP
+// keep-alive connection, is reused for all the parts sent by a worker
+// instead of paying a TCP/TLS handshake for each part. The client is
+// recreated after a failed request.
+// When a part checksum is given it is sent in the x-amz-checksum-* header;
+// SHA-256 checksums are also used as the signed payload hash.
+class Connection {
+   public:
+    explicit Connection(const Config& config)
+        : config_(config), checksumType_(ParseChecksumType(config.checksum)) {}
+    // PUT request for part 'partNum' of a multipart upload, or for the whole
+    // object if 'uploadId' is empty
+    WebClient& UploadRequest(const string& key, int partNum,
+                             const string& uploadId, const string& checksum) {
+        Parameters params;
+        if (!uploadId.empty()) {
+            params = {{"partNumber", to_string(partNum + 1)},
+                      {"uploadId", uploadId}};
+        }
+        const string path = "/" + config_.bucket + "/" + key;
+        const string payloadHash =
+            checksumType_ == ChecksumType::SHA256 ? Hex(checksum) : "";
+        auto signedHeaders = SignHeaders(
+            config_.s3AccessKey, config_.s3SecretKey, config_.endpoint, "PUT",
+            config_.bucket, key, payloadHash, params);
+        Headers headers(begin(signedHeaders), end(signedHeaders));
+        if (!checksum.empty()) {
+            headers[ChecksumHeader(checksumType_)] = Base64(checksum);
+        }
+        numRequestsG += 1;
+        if (client_ && !config_.noKeepAlive) {
+            client_->SetPath(path);
+            client_->SetReqParameters(params);
+            client_->SetHeaders(headers);
+        } else {
+            client_.reset(
+                new WebClient(config_.endpoint, path, "PUT", params, headers));
+            numClientsG += 1;
+        }
+        return *client_;
+    }
+    void Reset() { client_.reset(); }
+
+   private:
+    const Config& config_;
+    const ChecksumType checksumType_;
+    unique_ptr<WebClient> client_;
+};
+
+// requests sent and clients created; requests minus clients is only an upper
+// bound on the handshakes saved: a keep-alive connection closed by the
+// server or a proxy is reopened by the client without notice
+void PrintConnectionReuse() {
+    cout << "Requests: " << numRequestsG << ", clients: " << numClientsG
+         << ", handshakes saved: at most " << numRequestsG - numClientsG
+         << endl;
+}
+
+// begin multipart upload, returns upload id; retried up to maxRetries times
+string InitiateUpload(const Config& config, const string& key) {
+    const string path = "/" + config.bucket + "/" + key;
+    const ChecksumType checksumType = ParseChecksumType(config.checksum);
+    string error;
+    for (int tryNum = 1; tryNum <= config.maxRetries; ++tryNum) {
+        if (tryNum > 1) {
+            numRetriesG += 1;
+            Backoff(tryNum - 1);
+        }
+        auto signedHeaders =
+            SignHeaders(config.s3AccessKey, config.s3SecretKey,
+                        config.endpoint, "POST", config.bucket, key, "",
+                        {{"uploads=", ""}});
+        map<string, string> headers(begin(signedHeaders), end(signedHeaders));
+        if (checksumType != ChecksumType::NONE) {
+            headers["x-amz-checksum-algorithm"] =
+                ChecksumAlgorithm(checksumType);
+        }
+        WebClient req(config.endpoint, path, "POST", {{"uploads=", ""}},
+                      headers);
+        if (!req.Send()) {
+            error = "Error sending request: " + req.ErrorMsg();
+            continue;
+        }
+        if (req.StatusCode() >= 400) {
+            const string errcode = XMLTag(req.GetContentText(), "[Cc]ode");
+            error = "Error sending begin upload request - " + errcode;
+            continue;
+        }
+        vector<uint8_t> resp = req.GetContent();
+        const string xml(begin(resp), end(resp));
+        return XMLTag(xml, "[Uu]pload[Ii][dD]");
+    }
+    throw runtime_error(error);
 }
 
-string BuildEndUploadXML(vector<future<string>>& etags) {
+string BuildEndUploadXML(vector<future<string>>& etags,
+                         const vector<string>& checksums,
+                         ChecksumType checksumType) {
     string xml =
         "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
         "<CompleteMultipartUpload "
@@ -136,89 +275,236 @@ string BuildEndUploadXML(vector<future<string>>& etags) {
             throw runtime_error("Error - request " + to_string(i));
             return "";
         }
-        const string part = "<Part><ETag>" + etags[i].get() +
-                            "</ETag><PartNumber>" + to_string(i + 1) +
-                            "</PartNumber></Part>";
+        string part = "<Part><ETag>" + etags[i].get() + "</ETag>";
+        if (checksumType != ChecksumType::NONE) {
+            const string tag = ChecksumXMLTag(checksumType);
+            part += "<" + tag + ">" + Base64(checksums[i]) + "</" + tag + ">";
+        }
+        part += "<PartNumber>" + to_string(i + 1) + "</PartNumber></Part>";
         xml += part;
     }
     xml += "</CompleteMultipartUpload>";
     return xml;
 }
 
-WebClient BuildEndUploadRequest(const Config& config, const string& path,
+WebClient BuildEndUploadRequest(const Config& config, const string& key,
                                 vector<future<string>>& etags,
+                                const vector<string>& checksums,
                                 const string& uploadId) {
+    const string path = "/" + config.bucket + "/" + key;
     Parameters params = {{"uploadId", uploadId}};
     auto signedHeaders =
         SignHeaders(config.s3AccessKey, config.s3SecretKey, config.endpoint,
-                    "POST", config.bucket, config.key, "", params);
+                    "POST", config.bucket, key, "", params);
     Headers headers(begin(signedHeaders), end(signedHeaders));
     WebClient req(config.endpoint, path, "POST", params, headers);
     req.SetMethod("POST");
-    req.SetPostData(BuildEndUploadXML(etags));
+    req.SetPostData(BuildEndUploadXML(etags, checksums,
+                                      ParseChecksumType(config.checksum)));
     return req;
 }
 
-string UploadPart(const Config& config, const string& path,
-                  const string& uploadId, int i, size_t offset,
-                  size_t chunkSize, int maxTries = 1, int tryNum = 1) {
-    WebClient ul = BuildUploadRequest(config, path, i, uploadId);
-    const bool ok = ul.UploadFile(config.file, offset, chunkSize);
-    if (!ok) {
-        throw(runtime_error("Cannot upload chunk " + to_string(i + 1)));
-    }
-    const string etag = HTTPHeader(ul.GetHeaderText(), "[Ee][Tt]ag");
-    if (etag.empty()) {
-        if (tryNum == maxTries) {
-            throw(runtime_error("No ETag found in HTTP header"));
-        } else {
+// send end upload request, retried up to maxTries times; throws on failure
+void SendEndUpload(WebClient& endUpload, int maxTries) {
+    string error;
+    for (int tryNum = 1; tryNum <= maxTries; ++tryNum) {
+        if (tryNum > 1) {
             numRetriesG += 1;
-            return UploadPart(config, path, uploadId, i, offset, chunkSize,
-                              maxTries, ++tryNum);
+            Backoff(tryNum - 1);
+        }
+        if (!endUpload.Send()) {
+            error = endUpload.ErrorMsg();
+            continue;
         }
+        if (endUpload.StatusCode() >= 400) {
+            error = XMLTag(endUpload.GetContentText(), "[Cc]ode");
+            continue;
+        }
+        return;
     }
-    return etag;
+    throw runtime_error("Error sending end upload request - " + error);
 }
 
-string UploadPartMem(const char* src, const Config& config, const string& path,
-                     const string& uploadId, int i, size_t offset,
-                     size_t chunkSize, int maxTries = 1, int tryNum = 1) {
-    WebClient ul = BuildUploadRequest(config, path, i, uploadId);
-    const bool ok = ul.UploadDataFromBuffer(src, offset, chunkSize);
-    if (!ok) {
-        throw(runtime_error("Cannot upload chunk " + to_string(i + 1) + " " +
-                            ul.ErrorMsg()));
-    }
-    const string etag = HTTPHeader(ul.GetHeaderText(), "[Ee][Tt]ag");
-    if (etag.empty()) {
-        if (tryNum == maxTries) {
-            throw(runtime_error("No ETag found in HTTP header"));
-        } else {
+// upload part from file or from memory if src is not null, retrying up to
+// maxTries times on failure or missing ETag; a limiter slot is held for the
+// duration of each request, not during backoff.
+// With an empty upload id the data is sent as a single object.
+string UploadPart(const char* src, const string& file, const string& key,
+                  Connection& conn, ConcurrencyLimiter& limiter,
+                  const string& uploadId, int i, size_t offset,
+                  size_t chunkSize, const string& checksum, int maxTries = 1) {
+    string error;
+    for (int tryNum = 1; tryNum <= maxTries; ++tryNum) {
+        if (tryNum > 1) {
             numRetriesG += 1;
-            return UploadPartMem(src, config, path, uploadId, i, offset,
-                                 chunkSize, maxTries, ++tryNum);
+            conn.Reset();
+            Backoff(tryNum - 1);
         }
+        limiter.Acquire();
+        WebClient& ul = conn.UploadRequest(key, i, uploadId, checksum);
+        const bool ok = src ? ul.UploadDataFromBuffer(src, offset, chunkSize)
+                            : ul.UploadFile(file, offset, chunkSize);
+        if (!ok) {
+            limiter.Release(0, false);
+            error = "Cannot upload chunk " + to_string(i + 1) + " " +
+                    ul.ErrorMsg();
+            continue;
+        }
+        const string etag = HTTPHeader(ul.GetHeaderText(), "[Ee][Tt]ag");
+        limiter.Release(chunkSize, !etag.empty());
+        if (!etag.empty()) return etag;
+        error = "No ETag found in HTTP header, chunk " + to_string(i + 1);
     }
-    return etag;
+    throw runtime_error(error);
 }
 
-void InitConfig(Config& config) {
-    if (!config.s3AccessKey.empty() && !config.s3SecretKey.empty()) return;
-    const string fname = config.credentials.empty()
-                             ? GetHomeDir() + "/.aws/credentials"
-                             : config.credentials;
-    config.awsProfile =
-        config.awsProfile.empty() ? "default" : config.awsProfile;
-    Toml toml = ParseTomlFile(fname);  // only default profile supported
-    if (toml.find(config.awsProfile) == toml.end()) {
-        throw invalid_argument("ERROR: profile " + config.awsProfile +
-                               " not found");
-    }
-    config.s3AccessKey = toml[config.awsProfile]["aws_access_key_id"];
-    config.s3SecretKey = toml[config.awsProfile]["aws_secret_access_key"];
+//------------------------------------------------------------------------------
+// Upload journal: append-only text file with the upload id, the identity of
+// the source file, the part size and the checksum algorithm declared when
+// the upload was initiated, followed by one line per completed part:
+//   upload <upload id> <bucket> <key> <size> <mtime ns> <data version>
+//          <part size> <none|crc32c|sha256>
+//   part <part index> <ETag> [<hex checksum>]
+// With --resume only the parts missing from the journal are uploaded.
+// The journal is deleted when the upload is completed.
+
+// source file identity, data version only available on Lustre
+struct SourceId {
+    size_t size = 0;
+    uint64_t mtime = 0;  // ns
+    uint64_t dataVersion = 0;
+    bool operator==(const SourceId& other) const {
+        return size == other.size && mtime == other.mtime &&
+               dataVersion == other.dataVersion;
+    }
+};
+
+SourceId GetSourceId(const string& fname) {
+    struct stat st;
+    if (stat(fname.c_str(), &st)) {
+        throw runtime_error("Cannot access " + fname + ": " + strerror(errno));
+    }
+    SourceId id;
+    id.size = st.st_size;
+    id.mtime = uint64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#ifdef LUSTRE_LAYOUT
+    const int fd = open(fname.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        __u64 dv = 0;
+        if (llapi_get_data_version(fd, &dv, LL_DV_RD_FLUSH) == 0) {
+            id.dataVersion = dv;
+        }
+        close(fd);
+    }
+#endif
+    return id;
+}
+
+struct JournalInfo {
+    string uploadId;
+    string bucket;
+    string key;
+    SourceId source;
+    size_t partSize = 0;
+    string checksum = "none";    // algorithm, as -x
+    map<int, string> etags;      // completed parts
+    map<int, string> checksums;  // binary, if computed
+};
+
+// returns false if the journal does not exist; the last line is ignored if
+// it is not terminated by a newline: the process was killed while writing it
+bool ReadJournal(const string& path, JournalInfo& info) {
+    ifstream is(path);
+    if (!is) return false;
+    string line;
+    bool header = false;
+    while (getline(is, line)) {
+        if (is.eof()) break;  // no newline: truncated
+        istringstream ls(line);
+        string type;
+        ls >> type;
+        if (type == "upload") {
+            ls >> info.uploadId >> info.bucket >> info.key >>
+                info.source.size >> info.source.mtime >>
+                info.source.dataVersion >> info.partSize >> info.checksum;
+            header = bool(ls);
+        } else if (type == "part") {
+            int i = -1;
+            string etag;
+            string checksum;
+            ls >> i >> etag;
+            const bool quoted =
+                etag.size() > 1 && etag.front() == '"' && etag.back() == '"';
+            if (!ls || i < 0 || !quoted) continue;
+            info.etags[i] = etag;
+            if (ls >> checksum) info.checksums[i] = FromHex(checksum);
+        }
+    }
+    if (!header) {
+        throw runtime_error("ERROR: invalid journal " + path);
+    }
+    return true;
 }
 
-void LoadData(const char* fname, char* dest, size_t offset, size_t size) {
+class PartJournal {
+   public:
+    // truncate unless resuming
+    PartJournal(const string& path, bool resume) : path_(path) {
+        fd_ = open(path.c_str(),
+                   O_WRONLY | O_CREAT | O_APPEND | (resume ? 0 : O_TRUNC),
+                   0644);
+        if (fd_ < 0) {
+            throw runtime_error("Cannot open journal " + path + ": " +
+                                strerror(errno));
+        }
+        // terminate a line truncated by a killed process, so that it is not
+        // merged with the first line appended now
+        char last = '\n';
+        const int rfd = resume ? open(path.c_str(), O_RDONLY) : -1;
+        if (rfd >= 0) {
+            const off_t size = lseek(rfd, 0, SEEK_END);
+            if (size > 0 && pread(rfd, &last, 1, size - 1) != 1) last = '\n';
+            close(rfd);
+        }
+        if (last != '\n') Append("\n");
+    }
+    ~PartJournal() {
+        if (fd_ >= 0) close(fd_);
+    }
+    void Begin(const JournalInfo& info) {
+        Append("upload " + info.uploadId + " " + info.bucket + " " +
+               info.key + " " + to_string(info.source.size) + " " +
+               to_string(info.source.mtime) + " " +
+               to_string(info.source.dataVersion) + " " +
+               to_string(info.partSize) + " " + info.checksum + "\n");
+    }
+    // called concurrently by the upload workers: one write per line on an
+    // O_APPEND descriptor, no locking required
+    void Record(int part, const string& etag, const string& checksum) {
+        Append("part " + to_string(part) + " " + etag +
+               (checksum.empty() ? "" : " " + Hex(checksum)) + "\n");
+    }
+    void Remove() {
+        close(fd_);
+        fd_ = -1;
+        unlink(path_.c_str());
+    }
+
+   private:
+    void Append(const string& line) {
+        if (write(fd_, line.data(), line.size()) != ssize_t(line.size())) {
+            throw runtime_error("Error writing to journal " + path_);
+        }
+    }
+    string path_;
+    int fd_ = -1;
+};
+
+// read data in chunks, the checksum is updated after each chunk is read
+// while the data is still in cache
+void LoadData(const char* fname, char* dest, size_t offset, size_t size,
+              Checksum* checksum = nullptr) {
+    const size_t CHUNK_SIZE = 1 << 20;
     FILE* f = fopen(fname, "rb");
     if (!f) {
         throw runtime_error("Cannot open input file for reading");
@@ -226,21 +512,397 @@ void LoadData(const char* fname, char* dest, size_t offset, size_t size) {
     if (fseek(f, offset, SEEK_SET)) {
         throw runtime_error("Cannot move file pointer");
     }
-    if (fread(dest, size, 1, f) != 1) {
-        throw runtime_error("Error reading input file");
+    for (size_t done = 0; done < size;) {
+        const size_t n = min(CHUNK_SIZE, size - done);
+        if (fread(dest + done, n, 1, f) != 1) {
+            throw runtime_error("Error reading input file");
+        }
+        if (checksum) checksum->Update(dest + done, n);
+        done += n;
     }
     if (fclose(f)) {
         throw runtime_error("Error closing input file after read operation");
     }
 }
 
+// compute part checksum; when reading from file (data is null) the part is
+// loaded into 'buffer' and hashed while reading, so that the file is read
+// only once, and data and offset are updated to point to the buffer
+string PartChecksum(ChecksumType type, const string& file, size_t size,
+                    const char*& data, size_t& offset, vector<char>& buffer) {
+    Checksum checksum(type);
+    if (data) {
+        checksum.Update(data + offset, size);
+    } else {
+        buffer.resize(size);
+        LoadData(file.c_str(), buffer.data(), offset, size, &checksum);
+        data = buffer.data();
+        offset = 0;
+    }
+    return checksum.Digest();
+}
+
+// upload parts from file or from memory if src is not null
+void UploadParts(const char* src, const Config& config,
+                 const string& uploadId, PartQueue& parts,
+                 PartJournal& journal, ConcurrencyLimiter& limiter) {
+    Connection conn(config);
+    const ChecksumType checksumType = ParseChecksumType(config.checksum);
+    vector<char> buffer;
+    for (int i = parts.Next(); i >= 0; i = parts.Next()) {
+        auto start = chrono::high_resolution_clock::now();
+        try {
+            const char* data = src;
+            size_t offset = parts.Offset(i);
+            if (checksumType != ChecksumType::NONE &&
+                parts.checksums[i].empty()) {
+                parts.checksums[i] = PartChecksum(
+                    checksumType, config.file, parts.Size(i), data, offset,
+                    buffer);
+            }
+            const string etag = UploadPart(
+                data, config.file, config.key, conn, limiter, uploadId, i,
+                offset, parts.Size(i), parts.checksums[i], config.maxRetries);
+            journal.Record(i, etag, parts.checksums[i]);
+            parts.etags[i].set_value(etag);
+        } catch (...) {
+            parts.etags[i].set_exception(current_exception());
+        }
+        auto end = chrono::high_resolution_clock::now();
+        parts.seconds[i] = chrono::duration<float>(end - start).count();
+    }
+}
+
+// load parts into memory buffer, computing part checksums if required
+void LoadParts(const char* fname, char* dest, PartQueue& parts,
+               atomic<int>& nextPart, ChecksumType checksumType) {
+    for (int i = parts.Next(nextPart); i >= 0; i = parts.Next(nextPart)) {
+        Checksum checksum(checksumType);
+        LoadData(fname, dest + parts.Offset(i), parts.Offset(i), parts.Size(i),
+                 &checksum);
+        parts.checksums[i] = checksum.Digest();
+    }
+}
+
+//------------------------------------------------------------------------------
+// Streaming upload: reader threads load parts into a fixed pool of buffers,
+// uploader threads send them and return the buffers to the pool; readers
+// block when no buffer is free, so reading never runs ahead of the network
+// by more than the number of buffers.
+
+struct StreamState {
+    PartQueue& parts;
+    PartJournal& journal;
+    ConcurrencyLimiter& limiter;
+    BlockingQueue<char*> freeBuffers;
+    BlockingQueue<Part> readyParts;
+    StreamState(PartQueue& p, PartJournal& j, ConcurrencyLimiter& l)
+        : parts(p), journal(j), limiter(l) {}
+};
+
+void StreamLoad(const Config& config, StreamState& state) {
+    PartQueue& parts = state.parts;
+    const ChecksumType checksumType = ParseChecksumType(config.checksum);
+    for (int i = parts.Next(); i >= 0; i = parts.Next()) {
+        Part p;
+        p.index = i;
+        p.size = parts.Size(i);
+        state.freeBuffers.Pop(p.data);  // back-pressure
+        try {
+            Checksum checksum(checksumType);
+            LoadData(config.file.c_str(), p.data, parts.Offset(i), p.size,
+                     &checksum);
+            parts.checksums[i] = checksum.Digest();
+        } catch (...) {
+            parts.etags[i].set_exception(current_exception());
+            state.freeBuffers.Push(p.data);
+            continue;
+        }
+        state.readyParts.Push(p);
+    }
+}
+
+void StreamUpload(const Config& config, const string& uploadId,
+                  StreamState& state) {
+    Connection conn(config);
+    Part p;
+    while (state.readyParts.Pop(p)) {
+        auto start = chrono::high_resolution_clock::now();
+        try {
+            const string& checksum = state.parts.checksums[p.index];
+            const string etag = UploadPart(
+                p.data, config.file, config.key, conn, state.limiter, uploadId,
+                p.index, 0, p.size, checksum, config.maxRetries);
+            state.journal.Record(p.index, etag, checksum);
+            state.parts.etags[p.index].set_value(etag);
+        } catch (...) {
+            state.parts.etags[p.index].set_exception(current_exception());
+        }
+        auto end = chrono::high_resolution_clock::now();
+        state.parts.seconds[p.index] =
+            chrono::duration<float>(end - start).count();
+        state.freeBuffers.Push(p.data);
+    }
+}
+
+// all parts are sent when the function returns
+void StreamUploadParts(const Config& config, const string& uploadId,
+                       PartQueue& parts,
+                       PartJournal& journal, ConcurrencyLimiter& limiter) {
+    StreamState state(parts, journal, limiter);
+    const int loadJobs = config.loadJobs > 0 ? config.loadJobs : config.jobs;
+    const int numBuffers =
+        config.numBuffers > 0 ? config.numBuffers : 2 * config.jobs;
+    vector<char> buffers(numBuffers * parts.partSize);
+    for (int b = 0; b != numBuffers; ++b) {
+        state.freeBuffers.Push(buffers.data() + b * parts.partSize);
+    }
+    vector<future<void>> loaders(loadJobs);
+    for (auto& l : loaders) {
+        l = async(launch::async, StreamLoad, cref(config), ref(state));
+    }
+    vector<future<void>> uploaders(config.jobs);
+    for (auto& u : uploaders) {
+        u = async(launch::async, StreamUpload, cref(config), cref(uploadId),
+                  ref(state));
+    }
+    for (auto& l : loaders) l.wait();
+    state.readyParts.Close();
+    for (auto& u : uploaders) u.wait();
+    cout << "Streamed " << parts.numParts << " parts using " << numBuffers
+         << " buffers" << endl;
+}
+
+//------------------------------------------------------------------------------
+// Directory upload: all regular files under a directory are uploaded by a
+// single pool of workers shared by all files. Files larger than the part
+// size are sent as multipart uploads, the others with single PUT requests;
+// work units (parts and small files) are processed largest first so that
+// small files fill the gaps at the end. The multipart upload of a file is
+// initiated by the first worker taking one of its parts and completed by
+// the worker sending its last part. Each worker holds at most one open file
+// and one connection. Object keys are <key>/<path relative to directory>.
+
+struct Object {
+    string file;
+    string key;
+    size_t size = 0;
+    // multipart uploads only
+    unique_ptr<PartQueue> parts;
+    once_flag initiated;
+    string uploadId;
+    atomic<int> remaining{0};  // parts not sent yet
+};
+
+// part of multipart object or whole object if part < 0
+struct Task {
+    int object;
+    int part;
+    size_t size;
+};
+
+struct TreeStats {
+    atomic<size_t> objects{0};
+    atomic<size_t> bytes{0};
+    atomic<size_t> failed{0};
+};
+
+// regular files under 'dir', symbolic links are not followed;
+// pairs of (file path, path relative to top directory); entries which
+// cannot be read are reported and counted in 'errors'
+void ListFiles(const string& dir, const string& rel,
+               vector<pair<string, string>>& files, size_t& errors) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        cerr << "Cannot open directory " << dir << ": " << strerror(errno)
+             << endl;
+        ++errors;
+        return;
+    }
+    while (dirent* e = readdir(d)) {
+        const string name = e->d_name;
+        if (name == "." || name == "..") continue;
+        const string path = dir + "/" + name;
+        const string relPath = rel.empty() ? name : rel + "/" + name;
+        unsigned char type = e->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path.c_str(), &st)) {
+                cerr << "Cannot access " << path << ": " << strerror(errno)
+                     << endl;
+                ++errors;
+                continue;
+            }
+            type = S_ISDIR(st.st_mode)   ? DT_DIR
+                   : S_ISREG(st.st_mode) ? DT_REG
+                                         : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            ListFiles(path, relPath, files, errors);
+        } else if (type == DT_REG) {
+            files.push_back({path, relPath});
+        }
+    }
+    closedir(d);
+}
+
+void CompleteObject(const Config& config, Object& o, TreeStats& stats) {
+    try {
+        vector<future<string>> etags = o.parts->Futures();
+        WebClient endUpload = BuildEndUploadRequest(
+            config, o.key, etags, o.parts->checksums, o.uploadId);
+        SendEndUpload(endUpload, config.maxRetries);
+        const ChecksumType checksumType = ParseChecksumType(config.checksum);
+        if (checksumType != ChecksumType::NONE) {
+            const string remote = XMLTag(endUpload.GetContentText(),
+                                         ChecksumXMLTag(checksumType));
+            if (!remote.empty() &&
+                remote != CompositeChecksum(checksumType, o.parts->checksums)) {
+                throw runtime_error("Checksum mismatch");
+            }
+        }
+        stats.objects += 1;
+        stats.bytes += o.size;
+    } catch (const exception& e) {
+        stats.failed += 1;
+        cerr << o.file << " (upload id " << o.uploadId << "): " << e.what()
+             << endl;
+    }
+}
+
+void UploadTasks(const Config& config, vector<unique_ptr<Object>>& objects,
+                 const vector<Task>& tasks, atomic<size_t>& nextTask,
+                 ConcurrencyLimiter& limiter, TreeStats& stats) {
+    Connection conn(config);
+    const ChecksumType checksumType = ParseChecksumType(config.checksum);
+    vector<char> buffer;
+    for (size_t t = nextTask++; t < tasks.size(); t = nextTask++) {
+        Object& o = *objects[tasks[t].object];
+        const int i = tasks[t].part;
+        const char* data = nullptr;
+        if (i < 0) {
+            try {
+                size_t offset = 0;
+                string checksum;
+                if (checksumType != ChecksumType::NONE) {
+                    checksum = PartChecksum(checksumType, o.file, o.size,
+                                            data, offset, buffer);
+                }
+                UploadPart(data, o.file, o.key, conn, limiter, "", 0, 0,
+                           o.size, checksum, config.maxRetries);
+                stats.objects += 1;
+                stats.bytes += o.size;
+            } catch (const exception& e) {
+                stats.failed += 1;
+                cerr << o.file << ": " << e.what() << endl;
+            }
+            continue;
+        }
+        PartQueue& parts = *o.parts;
+        try {
+            call_once(o.initiated,
+                      [&] { o.uploadId = InitiateUpload(config, o.key); });
+            size_t offset = parts.Offset(i);
+            if (checksumType != ChecksumType::NONE) {
+                parts.checksums[i] = PartChecksum(
+                    checksumType, o.file, parts.Size(i), data, offset, buffer);
+            }
+            parts.etags[i].set_value(UploadPart(
+                data, o.file, o.key, conn, limiter, o.uploadId, i, offset,
+                parts.Size(i), parts.checksums[i], config.maxRetries));
+        } catch (...) {
+            parts.etags[i].set_exception(current_exception());
+        }
+        if (--o.remaining == 0) CompleteObject(config, o, stats);
+    }
+}
+
+// returns number of objects not uploaded, including files and directories
+// which could not be read
+size_t UploadDirectory(Config config) {
+    TreeStats stats;
+    vector<pair<string, string>> files;
+    size_t listErrors = 0;
+    ListFiles(config.dir, "", files, listErrors);
+    stats.failed += listErrors;
+    string prefix = config.key;
+    while (!prefix.empty() && prefix.back() == '/') prefix.pop_back();
+    vector<unique_ptr<Object>> objects;
+    vector<Task> tasks;
+    size_t totalBytes = 0;
+    size_t numMultipart = 0;
+    for (const auto& f : files) {
+        unique_ptr<Object> o(new Object);
+        o->file = f.first;
+        o->key = prefix.empty() ? f.second : prefix + "/" + f.second;
+        // file removed or unreadable since the directory was listed
+        try {
+            o->size = FileSize(o->file);
+        } catch (const exception& e) {
+            stats.failed += 1;
+            cerr << o->file << ": " << e.what() << endl;
+            continue;
+        }
+        totalBytes += o->size;
+        const int index = int(objects.size());
+        if (o->size > config.partSize) {
+            const StripeLayout stripes = GetStripeLayout(o->file);
+            o->parts.reset(new PartQueue(
+                o->size, PartSize(config.partSize, o->size, stripes),
+                stripes));
+            o->remaining = o->parts->numParts;
+            for (int i : o->parts->order) {
+                tasks.push_back({index, i, o->parts->Size(i)});
+            }
+            ++numMultipart;
+        } else {
+            tasks.push_back({index, -1, o->size});
+        }
+        objects.push_back(move(o));
+    }
+    stable_sort(begin(tasks), end(tasks),
+                [](const Task& a, const Task& b) { return a.size > b.size; });
+    // one file descriptor and one socket per worker
+    rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 &&
+        rlim_t(2 * config.jobs + 64) > rl.rlim_cur) {
+        config.jobs = max(1, int((rl.rlim_cur - 64) / 2));
+        cout << "Jobs limited to " << config.jobs
+             << " by the open file descriptor limit (" << rl.rlim_cur << ")"
+             << endl;
+    }
+    ConcurrencyLimiter limiter(config.jobs, config.adaptive);
+    atomic<size_t> nextTask{0};
+    const auto start = chrono::steady_clock::now();
+    vector<future<void>> workers(config.jobs);
+    for (auto& w : workers) {
+        w = async(launch::async, UploadTasks, cref(config), ref(objects),
+                  cref(tasks), ref(nextTask), ref(limiter), ref(stats));
+    }
+    for (auto& w : workers) w.wait();
+    const double seconds =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << fixed << setprecision(3) << "Objects: " << stats.objects << " of "
+         << objects.size() << " (" << numMultipart << " multipart), "
+         << stats.bytes << " of " << totalBytes << " bytes" << endl
+         << "Time: " << seconds << " s, "
+         << setprecision(1) << stats.objects / seconds << " objects/s, "
+         << setprecision(3) << stats.bytes / seconds / (1 << 30) << " GiB/s"
+         << endl;
+    PrintConnectionReuse();
+    if (config.adaptive) limiter.PrintTrajectory();
+    if (numRetriesG > 0) cout << "Num retries: " << numRetriesG << endl;
+    if (stats.failed > 0) cerr << "Failed: " << stats.failed << endl;
+    return stats.failed;
+}
+
 //------------------------------------------------------------------------------
 int main(int argc, char const* argv[]) {
     try {
         Config config;
         auto cli =
             lyra::help(config.showHelp)
-                .description("Upload file to S3 bucket") |
+                .description("Upload file or directory to S3 bucket") |
             lyra::opt(config.s3AccessKey,
                       "awsAccessKey")["-a"]["--access_key"]("AWS access key")
                 .optional() |
@@ -252,9 +914,14 @@ int main(int argc, char const* argv[]) {
                 .required() |
             lyra::opt(config.bucket, "bucket")["-b"]["--bucket"]("Bucket name")
                 .required() |
-            lyra::opt(config.key, "key")["-k"]["--key"]("Key name").required() |
-            lyra::opt(config.file, "file")["-f"]["--file"]("File name")
+            lyra::opt(config.key, "key")["-k"]["--key"](
+                "Key name, prefix with --dir")
                 .required() |
+            lyra::opt(config.file, "file")["-f"]["--file"]("File name")
+                .optional() |
+            lyra::opt(config.dir, "directory")["-d"]["--dir"](
+                "Upload all files under directory, key is used as prefix")
+                .optional() |
             lyra::opt(config.jobs, "parallel jobs")["-j"]["--jobs"](
                 "Number inputFile parallel jobs")
                 .optional() |
@@ -271,12 +938,36 @@ int main(int argc, char const* argv[]) {
                 .optional() |
             lyra::opt(config.memoryMapping,
                       "Configure memory mapping options")["-m"]["--mmap"](
-                "memory mapping: 'none', 'map', 'preload'")
-                .choices("none", "preload", "map")
+                "memory mapping: 'none', 'map', 'preload', 'stream'")
+                .choices("none", "preload", "map", "stream")
+                .optional() |
+            lyra::opt(config.partSize, "part size")["-P"]["--part-size"](
+                "Multipart upload part size, default 64 MiB")
+                .optional() |
+            lyra::opt(config.numBuffers, "buffers")["-B"]["--buffers"](
+                "Number of part buffers in streaming mode")
+                .optional() |
+            lyra::opt(config.loadJobs, "load jobs")["-l"]["--load-jobs"](
+                "Number of threads reading parts in streaming mode")
+                .optional() |
+            lyra::opt(config.noKeepAlive)["-n"]["--no-keep-alive"](
+                "New connection for each part instead of one per job")
+                .optional() |
+            lyra::opt(config.journal, "journal")["-J"]["--journal"](
+                "Part journal file, default <file>.upload_journal")
+                .optional() |
+            lyra::opt(config.resume)["--resume"](
+                "Upload only the parts missing from the journal")
+                .optional() |
+            lyra::opt(config.checksum, "checksum")["-x"]["--checksum"](
+                "Per-part checksum header: none, crc32c or sha256")
+                .choices("none", "crc32c", "sha256")
+                .optional() |
+            lyra::opt(config.adaptive)["-A"]["--adaptive"](
+                "Adapt number of parts in flight (up to --jobs) to throughput "
+                "and throttling")
                 .optional();
 
-        InitConfig(config);
-
         // Parse the program arguments:
         auto result = cli.parse({argc, argv});
 
@@ -289,7 +980,11 @@ int main(int argc, char const* argv[]) {
             cout << cli;
             return 0;
         }
+        // after parsing: keys and credentials file can be set on the
+        // command line
+        InitConfig(config);
         Validate(config);
+        if (!config.dir.empty()) return UploadDirectory(config) > 0 ? 1 : 0;
         FILE* inputFile = fopen(config.file.c_str(), "rb");
         if (!inputFile) {
             throw runtime_error(string("cannot open file ") + config.file);
@@ -300,115 +995,166 @@ int main(int argc, char const* argv[]) {
         if (config.jobs > 1) {
             // retrieve file size
             const size_t fileSize = FileSize(config.file);
-            // compute chunk size
-            const size_t chunkSize = fileSize / config.jobs;
-            // compute last chunk size
-            const size_t lastChunkSize = fileSize % config.jobs == 0
-                                             ? chunkSize
-                                             : fileSize % config.jobs;
-            // initiate request
-            auto signedHeaders = SignHeaders(
-                config.s3AccessKey, config.s3SecretKey, config.endpoint, "POST",
-                config.bucket, config.key, "", {{"uploads=", ""}});
-            map<string, string> headers(begin(signedHeaders),
-                                        end(signedHeaders));
-            WebClient req(config.endpoint, path, "POST", {{"uploads=", ""}},
-                          headers);
-            if (!req.Send()) {
-                throw runtime_error("Error sending request: " + req.ErrorMsg());
+            const SourceId source = GetSourceId(config.file);
+            const string journalPath = config.journal.empty()
+                                           ? config.file + ".upload_journal"
+                                           : config.journal;
+            JournalInfo info;
+            bool resume = false;
+            if (config.resume) {
+                resume = ReadJournal(journalPath, info);
+                if (!resume) {
+                    cout << "No journal found, starting new upload" << endl;
+                } else if (info.bucket != config.bucket ||
+                           info.key != config.key || !(info.source == source)) {
+                    throw runtime_error(
+                        "ERROR: source file or destination changed since "
+                        "the journal was written, remove " +
+                        journalPath);
+                } else if (info.checksum != config.checksum) {
+                    // the algorithm is fixed when the upload is initiated
+                    throw runtime_error(
+                        "ERROR: upload was started with checksum " +
+                        info.checksum + ", resume with -x " + info.checksum);
+                }
             }
-            if (req.StatusCode() >= 400) {
-                const string errcode = XMLTag(req.GetContentText(), "[Cc]ode");
-                throw runtime_error("Error sending begin upload request - " +
-                                    errcode);
+            // parts are independent of the number of jobs
+            const StripeLayout stripes = GetStripeLayout(config.file);
+            const size_t partSize =
+                resume ? info.partSize
+                       : PartSize(config.partSize, fileSize, stripes);
+            PartQueue parts(fileSize, partSize, stripes);
+            const ChecksumType checksumType =
+                ParseChecksumType(config.checksum);
+            if (stripes.stripeSize > 0) {
+                cout << "Stripe size: " << stripes.stripeSize
+                     << ", stripe count: " << stripes.stripeCount << endl;
+            }
+            if (!resume) {
+                info.uploadId = InitiateUpload(config, config.key);
+                info.bucket = config.bucket;
+                info.key = config.key;
+                info.source = source;
+                info.partSize = partSize;
+                info.checksum = config.checksum;
             }
-            vector<uint8_t> resp = req.GetContent();
-            const string xml(begin(resp), end(resp));
-            const string uploadId = XMLTag(xml, "[Uu]pload[Ii][dD]");
-            vector<future<string>> etags(config.jobs);
+            PartJournal journal(journalPath, resume);
+            if (!resume) journal.Begin(info);
+            const string uploadId = info.uploadId;
+            // workers are started for the maximum number of jobs, the limiter
+            // sets how many of them have a request in flight
+            ConcurrencyLimiter limiter(config.jobs, config.adaptive);
+            vector<future<string>> etags = parts.Futures();
+            if (resume) {
+                vector<bool> done(parts.numParts, false);
+                for (const auto& kv : info.etags) {
+                    const int i = kv.first;
+                    if (i >= parts.numParts || done[i]) continue;
+                    // parts recorded without a checksum of the upload
+                    // algorithm are sent again
+                    const string& checksum = info.checksums[i];
+                    if (checksum.size() != ChecksumSize(checksumType))
+                        continue;
+                    parts.checksums[i] = checksum;
+                    parts.etags[i].set_value(kv.second);
+                    done[i] = true;
+                }
+                parts.Skip(done);
+                cout << "Resuming upload: "
+                     << count(begin(done), end(done), true) << " of "
+                     << parts.numParts << " parts already uploaded" << endl;
+            }
+            PrintStartStripes(parts, config.jobs);
             int fin = -1;
             char* src = nullptr;
             vector<char> preloadBuffer;  // in case of pre-load
+            vector<future<void>> uploaders(config.jobs);
             if (config.memoryMapping == "map") {
                 fin = open(config.file.c_str(), O_RDONLY | O_LARGEFILE);
                 if (fin < 0) throw runtime_error("Cannot open input file");
                 src =
                     (char*)mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fin, 0);
-                if (src == MAP_FAILED) runtime_error("Cannot map input file");
-                for (int i = 0; i != config.jobs; ++i) {
-                    const size_t sz =
-                        i != config.jobs - 1 ? chunkSize : lastChunkSize;
-                    etags[i] = async(launch::async, UploadPartMem, src, config,
-                                     path, uploadId, i, chunkSize * i, sz,
-                                     config.maxRetries, 1);
+                if (src == MAP_FAILED)
+                    throw runtime_error("Cannot map input file");
+                for (auto& u : uploaders) {
+                    u = async(launch::async, UploadParts, src, cref(config),
+                              cref(uploadId), ref(parts), ref(journal),
+                              ref(limiter));
                 }
             } else if (config.memoryMapping == "preload") {
-                const size_t fsize = FileSize(config.file);
-                if (fsize <= 0) {
+                if (fileSize <= 0) {
                     throw runtime_error("Error retrieving file size");
                 }
-                preloadBuffer.resize(fsize);
-                FILE* f = fopen(config.file.c_str(), "rb");
-                if (!f) {
-                    throw runtime_error("Cannot open input file for reading");
-                }
+                preloadBuffer.resize(fileSize);
+                atomic<int> nextPart{0};
                 vector<future<void>> loaders(config.jobs);
                 auto start = chrono::high_resolution_clock::now();
-                for (int j = 0; j != config.jobs; ++j) {
-                    const size_t sz =
-                        j != config.jobs - 1 ? chunkSize : lastChunkSize;
-                    loaders[j] =
-                        async(launch::async, LoadData, config.file.c_str(),
-                              preloadBuffer.data(), chunkSize * j, sz);
+                for (auto& l : loaders) {
+                    l = async(launch::async, LoadParts, config.file.c_str(),
+                              preloadBuffer.data(), ref(parts), ref(nextPart),
+                              checksumType);
                 }
-                for (auto& l : loaders) l.wait();
+                for (auto& l : loaders) l.get();
                 auto end = chrono::high_resolution_clock::now();
                 cout << "Read time: "
                      << chrono::duration_cast<chrono::milliseconds>(end - start)
                             .count()
                      << " ms" << endl;
-                for (int i = 0; i != config.jobs; ++i) {
-                    const size_t sz =
-                        i != config.jobs - 1 ? chunkSize : lastChunkSize;
-                    etags[i] =
-                        async(launch::async, UploadPartMem,
-                              &preloadBuffer[0] + chunkSize * i, config, path,
-                              uploadId, i, 0, sz, config.maxRetries, 1);
+                for (auto& u : uploaders) {
+                    u = async(launch::async, UploadParts, preloadBuffer.data(),
+                              cref(config), cref(uploadId), ref(parts),
+                              ref(journal), ref(limiter));
                 }
+            } else if (config.memoryMapping == "stream") {
+                StreamUploadParts(config, uploadId, parts, journal, limiter);
             } else if (config.memoryMapping == "none") {
-                for (int i = 0; i != config.jobs; ++i) {
-                    const size_t sz =
-                        i != config.jobs - 1 ? chunkSize : lastChunkSize;
-                    etags[i] =
-                        async(launch::async, UploadPart, config, path, uploadId,
-                              i, chunkSize * i, sz, config.maxRetries, 1);
+                for (auto& u : uploaders) {
+                    u = async(launch::async, UploadParts, nullptr,
+                              cref(config), cref(uploadId), ref(parts),
+                              ref(journal), ref(limiter));
                 }
             } else {
                 throw invalid_argument("Wrong memory mapping option");
             }
+            for (auto& u : uploaders) {
+                if (u.valid()) u.wait();
+            }
+            cout << "Parts: " << parts.numParts << " x " << parts.partSize
+                 << " bytes" << endl;
+            PrintPartTimes("upload", parts.seconds);
+            PrintConnectionReuse();
+            if (config.adaptive) limiter.PrintTrajectory();
 
-            WebClient endUpload =
-                BuildEndUploadRequest(config, path, etags, uploadId);
-            if (config.memoryMapping == "mmap") {
+            WebClient endUpload = BuildEndUploadRequest(
+                config, config.key, etags, parts.checksums, uploadId);
+            if (config.memoryMapping == "map") {
                 if (munmap(src, fileSize))
                     throw runtime_error("Cannot unmap output file");
                 if (close(fin)) throw runtime_error("Error closing input file");
             }
-            if (!endUpload.Send()) {
-                throw runtime_error("Error sending request: " + req.ErrorMsg());
-            }
-            if (endUpload.StatusCode() >= 400) {
-                const string errcode =
-                    XMLTag(endUpload.GetContentText(), "[Cc]ode");
-                throw runtime_error("Error sending end unpload request - " +
-                                    errcode);
-            }
+            SendEndUpload(endUpload, config.maxRetries);
             const string etag =
                 XMLTag(endUpload.GetContentText(), "[Ee][Tt]ag");
             if (etag.empty()) {
                 cerr << "Error sending end upload request" << endl;
+            } else {
+                journal.Remove();
             }
             cout << etag << endl;
+            if (checksumType != ChecksumType::NONE) {
+                // composite checksum of the object, compared with the one
+                // returned by the server if any
+                const string checksum =
+                    CompositeChecksum(checksumType, parts.checksums);
+                cout << "Checksum (" << ChecksumAlgorithm(checksumType)
+                     << "): " << checksum << endl;
+                const string remote = XMLTag(endUpload.GetContentText(),
+                                             ChecksumXMLTag(checksumType));
+                if (!remote.empty() && remote != checksum) {
+                    throw runtime_error(
+                        "ERROR: checksum mismatch, server returned " + remote);
+                }
+            }
         } else {
             auto signedHeaders = SignHeaders(
                 config.s3AccessKey, config.s3SecretKey, config.endpoint, "PUT",
@@ -0,0 +1,385 @@
+
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Ugo Varetto
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions inputFile source code must retain the above copyright
+ *notice, this list inputFile conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list inputFile conditions and the following disclaimer in the
+ *documentation and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name inputFile the copyright holder nor the names inputFile
+ *its contributors may be used to endorse or promote products derived from this
+ *software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Code shared by parallel_upload and parallel_download: credentials, retry
+// backoff, part scheduling aligned to the Lustre stripe layout and the
+// bounded buffer queues used to overlap file and network I/O.
+
+#pragma once
+
+#ifdef LUSTRE_LAYOUT
+#include <lustre/lustreapi.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "utility.h"
+
+// S3 limits
+const size_t MAX_PARTS = 10000;
+const size_t MIN_PART_SIZE = size_t(5) << 20;
+const size_t MAX_PART_SIZE = size_t(5) << 30;
+
+// read keys from credentials file if not specified on the command line
+template <typename ConfigT>
+void InitConfig(ConfigT& config) {
+    if (!config.s3AccessKey.empty() && !config.s3SecretKey.empty()) return;
+    const std::string fname = config.credentials.empty()
+                                  ? GetHomeDir() + "/.aws/credentials"
+                                  : config.credentials;
+    config.awsProfile =
+        config.awsProfile.empty() ? "default" : config.awsProfile;
+    Toml toml = ParseTomlFile(fname);  // only default profile supported
+    if (toml.find(config.awsProfile) == toml.end()) {
+        throw std::invalid_argument("ERROR: profile " + config.awsProfile +
+                                    " not found");
+    }
+    config.s3AccessKey = toml[config.awsProfile]["aws_access_key_id"];
+    config.s3SecretKey = toml[config.awsProfile]["aws_secret_access_key"];
+}
+
+// exponential backoff with jitter before retry number 'tryNum'
+inline void Backoff(int tryNum) {
+    thread_local std::mt19937 gen(std::random_device{}());
+    const int maxDelay = std::min(100 << std::min(tryNum - 1, 10), 10000);
+    std::uniform_int_distribution<int> delay(maxDelay / 2, maxDelay);
+    std::this_thread::sleep_for(std::chrono::milliseconds(delay(gen)));
+}
+
+//------------------------------------------------------------------------------
+// stripe size and count, zero if not available
+struct StripeLayout {
+    uint64_t stripeSize = 0;
+    uint64_t stripeCount = 0;
+};
+
+// layout of first component, plain splitting if not on Lustre
+inline StripeLayout GetStripeLayout(const std::string& fname) {
+    StripeLayout sl;
+#ifdef LUSTRE_LAYOUT
+    llapi_layout* layout = llapi_layout_get_by_path(fname.c_str(), 0);
+    if (!layout) return sl;
+    if (llapi_layout_stripe_size_get(layout, &sl.stripeSize) ||
+        llapi_layout_stripe_count_get(layout, &sl.stripeCount) ||
+        sl.stripeSize == 0 || sl.stripeCount == 0) {
+        sl = StripeLayout();
+    }
+    llapi_layout_free(layout);
+#endif
+    return sl;
+}
+
+//------------------------------------------------------------------------------
+// Parts are processed by a pool of workers each pulling the next part index
+// from a shared counter, a slow part only holds back one worker.
+// On striped files parts are scheduled round-robin across the OSTs on which
+// they start, so that concurrent parts hit different OSTs.
+struct PartQueue {
+    size_t fileSize = 0;
+    size_t partSize = 0;
+    StripeLayout layout;
+    int numParts = 0;
+    std::atomic<int> nextPart{0};
+    std::vector<int> order;  // scheduling order
+    std::vector<std::promise<std::string>> etags;
+    std::vector<float> seconds;  // per-part transfer time
+    std::vector<std::string> checksums;  // binary, upload integrity headers
+    PartQueue(size_t fsize, size_t psize, const StripeLayout& sl)
+        : fileSize(fsize),
+          partSize(psize),
+          layout(sl),
+          numParts((fsize + psize - 1) / psize),
+          order(numParts),
+          etags(numParts),
+          seconds(numParts),
+          checksums(numParts) {
+        std::iota(std::begin(order), std::end(order), 0);
+        if (sl.stripeSize == 0) return;
+        // rank of each part among the parts starting on the same OST
+        std::map<uint64_t, int> partsOnOST;
+        std::vector<std::pair<int, uint64_t>> key(numParts);
+        for (int i = 0; i != numParts; ++i) {
+            const uint64_t ost = StartStripe(i);
+            key[i] = {partsOnOST[ost]++, ost};
+        }
+        std::stable_sort(std::begin(order), std::end(order),
+                         [&key](int a, int b) { return key[a] < key[b]; });
+    }
+    size_t Offset(int i) const { return i * partSize; }
+    // stripe (i.e. OST in layout order) on which part i starts
+    uint64_t StartStripe(int i) const {
+        return (Offset(i) / layout.stripeSize) % layout.stripeCount;
+    }
+    size_t Size(int i) const {
+        return std::min(partSize, fileSize - Offset(i));
+    }
+    // next part to process, -1 if none left
+    int Next(std::atomic<int>& counter) const {
+        const int n = counter++;
+        return n < int(order.size()) ? order[n] : -1;
+    }
+    // remove parts already transferred from the schedule
+    void Skip(const std::vector<bool>& done) {
+        order.erase(std::remove_if(std::begin(order), std::end(order),
+                                   [&done](int i) { return done[i]; }),
+                    std::end(order));
+    }
+    int Next() { return Next(nextPart); }
+    std::vector<std::future<std::string>> Futures() {
+        std::vector<std::future<std::string>> f;
+        for (auto& p : etags) f.push_back(p.get_future());
+        return f;
+    }
+};
+
+// requested part size, increased if needed to stay within the S3 part
+// limit; on striped files parts are aligned to stripe boundaries: either a
+// divisor of the stripe size (one OST per part) or a multiple.
+// A part of k stripes with k and the stripe count not coprime makes every
+// part start on a subset of the OSTs (e.g. 64 x 1 MiB parts on 4, 8, 16...
+// OSTs all start on the first one) and concurrent workers move across the
+// OSTs in lockstep; k is therefore rounded up to the next integer coprime
+// with the stripe count, so that consecutive parts start on different OSTs.
+inline size_t PartSize(size_t requested, size_t fileSize,
+                       const StripeLayout& sl) {
+    size_t partSize =
+        std::max(requested, (fileSize + MAX_PARTS - 1) / MAX_PARTS);
+    const size_t stripeSize = sl.stripeSize;
+    if (stripeSize > 0) {
+        if (partSize >= stripeSize) {
+            uint64_t k = (partSize + stripeSize - 1) / stripeSize;
+            while (std::gcd(k, sl.stripeCount) != 1) ++k;
+            partSize = k * stripeSize;
+        } else {
+            size_t d = stripeSize / partSize;
+            while (stripeSize % d) --d;
+            partSize = stripeSize / d;
+        }
+    }
+    if (partSize > MAX_PART_SIZE) {
+        throw std::invalid_argument(
+            "ERROR: file too large for multipart transfer");
+    }
+    return partSize;
+}
+
+// number of parts starting on each stripe among the first 'n' scheduled,
+// i.e. the OSTs hit by the first round of 'n' concurrent workers
+inline void PrintStartStripes(const PartQueue& parts, int n) {
+    if (parts.layout.stripeSize == 0 || parts.order.empty()) return;
+    n = std::min(n, int(parts.order.size()));
+    std::map<uint64_t, int> count;
+    for (int i = 0; i != n; ++i) ++count[parts.StartStripe(parts.order[i])];
+    std::cout << "Start stripe of first " << n
+              << " parts (stripe: parts):";
+    for (const auto& kv : count) {
+        std::cout << " " << kv.first << ": " << kv.second;
+    }
+    std::cout << std::endl;
+}
+
+// distribution of per-part transfer times
+inline void PrintPartTimes(const std::string& label,
+                           std::vector<float> seconds) {
+    if (seconds.empty()) return;
+    std::sort(std::begin(seconds), std::end(seconds));
+    auto pct = [&seconds](double p) {
+        return seconds[std::min(seconds.size() - 1,
+                                size_t(p / 100. * seconds.size()))];
+    };
+    std::cout << std::fixed << std::setprecision(3) << "Part " << label
+              << " time (s): min " << seconds.front() << ", p50 " << pct(50)
+              << ", p90 " << pct(90) << ", p99 " << pct(99) << ", max "
+              << seconds.back() << std::endl;
+}
+
+//------------------------------------------------------------------------------
+// part held in memory
+struct Part {
+    int index = -1;
+    char* data = nullptr;
+    size_t size = 0;
+};
+
+// thread safe queue, Pop blocks until an element is available or the queue
+// is closed
+template <typename T>
+class BlockingQueue {
+   public:
+    void Push(const T& v) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push_back(v);
+        }
+        cv_.notify_one();
+    }
+    bool Pop(T& v) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return !queue_.empty() || closed_; });
+        if (queue_.empty()) return false;
+        v = queue_.front();
+        queue_.pop_front();
+        return true;
+    }
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        cv_.notify_all();
+    }
+
+   private:
+    std::deque<T> queue_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool closed_ = false;
+};
+
+//------------------------------------------------------------------------------
+// Limit on the number of requests in flight. Workers acquire a slot before
+// each request and release it with the outcome. With adaptive control the
+// limit starts at one and is adjusted after each window of 'limit'
+// completed requests (AIMD): it is increased by one while the throughput
+// of the window keeps rising and halved on throttling (503 SlowDown) or
+// errors, at most once per window. Without adaptive control the limit is
+// fixed to the maximum.
+class ConcurrencyLimiter {
+   public:
+    using Clock = std::chrono::steady_clock;
+    struct Sample {
+        float seconds;  // since start
+        int limit;
+        double throughput;  // MiB/s of the window, 0 on decrease
+    };
+    ConcurrencyLimiter(int maxLimit, bool adaptive)
+        : limit_(adaptive ? 1 : maxLimit),
+          maxLimit_(maxLimit),
+          adaptive_(adaptive),
+          start_(Clock::now()),
+          windowStart_(start_) {
+        trajectory_.push_back({0, limit_, 0});
+    }
+    void Acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return inFlight_ < limit_; });
+        ++inFlight_;
+    }
+    // bytes transferred if successful
+    void Release(size_t bytes, bool ok) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --inFlight_;
+            if (adaptive_) Update(bytes, ok);
+        }
+        cv_.notify_all();
+    }
+    // at most ~maxSamples samples, evenly spaced, last one always printed
+    void PrintTrajectory(size_t maxSamples = 50) const {
+        const size_t step = (trajectory_.size() + maxSamples - 1) / maxSamples;
+        std::cout << "Concurrency (s, in flight, MiB/s):";
+        for (size_t i = 0; i < trajectory_.size(); i += step) {
+            const Sample& s = i + step < trajectory_.size()
+                                  ? trajectory_[i]
+                                  : trajectory_.back();
+            std::cout << std::fixed << std::setprecision(2) << " "
+                      << s.seconds << "," << s.limit << ","
+                      << std::setprecision(1) << s.throughput;
+        }
+        std::cout << std::endl;
+    }
+
+   private:
+    void Update(size_t bytes, bool ok) {
+        const auto now = Clock::now();
+        if (!ok) {
+            if (decreased_) return;
+            limit_ = std::max(1, limit_ / 2);
+            decreased_ = true;
+            lastThroughput_ = 0;
+            NewWindow(now, 0);
+            return;
+        }
+        windowBytes_ += bytes;
+        if (++windowRequests_ < limit_) return;
+        const double seconds =
+            std::chrono::duration<double>(now - windowStart_).count();
+        const double throughput =
+            seconds > 0 ? windowBytes_ / seconds / (1 << 20) : 0;
+        // rising by more than noise
+        if (throughput > lastThroughput_ * 1.02 && limit_ < maxLimit_) {
+            ++limit_;
+        }
+        lastThroughput_ = throughput;
+        decreased_ = false;
+        NewWindow(now, throughput);
+    }
+    void NewWindow(Clock::time_point now, double throughput) {
+        windowStart_ = now;
+        windowBytes_ = 0;
+        windowRequests_ = 0;
+        trajectory_.push_back(
+            {std::chrono::duration<float>(now - start_).count(), limit_,
+             throughput});
+    }
+    int limit_;
+    const int maxLimit_;
+    const bool adaptive_;
+    int inFlight_ = 0;
+    const Clock::time_point start_;
+    Clock::time_point windowStart_;
+    size_t windowBytes_ = 0;
+    int windowRequests_ = 0;
+    double lastThroughput_ = 0;
+    bool decreased_ = false;
+    std::vector<Sample> trajectory_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+};
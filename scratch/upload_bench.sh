@@ -0,0 +1,88 @@
+#!/usr/bin/env bash
+# BSD 3-Clause License
+#
+# Copyright (c) 2020, Ugo Varetto
+# All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without
+# modification, are permitted provided that the following conditions are met:
+#
+# 1. Redistributions of source code must retain the above copyright notice,
+#    this list of conditions and the following disclaimer.
+#
+# 2. Redistributions in binary form must reproduce the above copyright notice,
+#    this list of conditions and the following disclaimer in the documentation
+#    and/or other materials provided with the distribution.
+#
+# 3. Neither the name of the copyright holder nor the names of its
+#    contributors may be used to endorse or promote products derived from
+#    this software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+# AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+# IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+# ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+# LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+# CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+# SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+# INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+# CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+# ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+# POSSIBILITY OF SUCH DAMAGE.
+
+# Upload throughput of parallel_upload against the local mock S3 server,
+# for each memory mode, number of jobs, with/without connection reuse and
+# with fixed or adaptive concurrency (ADAPTIVE="off on").
+# Extra arguments are passed to mock_s3, e.g. to cap bandwidth, inject
+# errors, add round trip time to requests and connection handshakes or
+# throttle requests above a concurrency:
+#   ./upload_bench.sh ./parallel_upload ./mock_s3 data/10G -b 2000 -e 0.01
+#   ./upload_bench.sh ./parallel_upload ./mock_s3 data/10G -l 20 -H 60
+#   ADAPTIVE="off on" ./upload_bench.sh ./parallel_upload ./mock_s3 \
+#     data/10G -c 200 -t 8
+ARGC=$#
+if [ $ARGC -lt 3 ]
+then
+  echo "Usage: $0 <parallel_upload> <mock_s3> <file> [mock_s3 options]"
+  exit 1
+fi
+upload=$1
+mock=$2
+file=$3
+shift 3
+port=${PORT:-9000}
+jobs_list=${JOBS:-"1 4 16 32"}
+modes=${MODES:-"none map preload stream"}
+keep_alive=${KEEP_ALIVE:-"on off"}
+adaptive=${ADAPTIVE:-"off"}
+part_size=${PART_SIZE:-$((64*2**20))}
+file_size=$(stat -c %s $file)
+
+$mock -p $port "$@" > mock_s3.log &
+mock_pid=$!
+trap "kill -INT $mock_pid" EXIT
+sleep 1
+
+echo "mode jobs keep-alive adaptive seconds GiB/s"
+for mode in $modes
+do
+  for jobs in $jobs_list
+  do
+    for ka in $keep_alive
+    do
+      for ad in $adaptive
+      do
+        [ $ka == "off" ] && ka_flag="-n" || ka_flag=""
+        [ $ad == "on" ] && ad_flag="-A" || ad_flag=""
+        start=$(date +%s.%N)
+        $upload -a key -s secret -e http://127.0.0.1:$port -b bench -k obj \
+          -f $file -j $jobs -m $mode -P $part_size -r 8 $ka_flag $ad_flag \
+          > /dev/null || exit 1
+        end=$(date +%s.%N)
+        awk -v m=$mode -v j=$jobs -v k=$ka -v a=$ad -v s=$start -v e=$end \
+          -v b=$file_size 'BEGIN { printf "%s %d %s %s %.3f %.3f\n", m, j,
+                                   k, a, e - s, b / (e - s) / 2^30 }'
+      done
+    done
+  done
+done
@@ -37,27 +37,306 @@
 
 //create file with desired stripe size on 
 
+#include <fcntl.h>
 #include <lustre/lustreapi.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <cerrno>
+#include <cstring>
+#include <fstream>
 #include <iostream>
+#include <lyra/lyra.hpp>
+#include <map>
+#include <regex>
+#include <string>
+#include <vector>
+
+#include "ost_index.h"
 
 using namespace std;
+
+// Configuration information read from command line
+struct Config {
+    string fileName;
+    uint64_t stripeSize = 0;
+    uint64_t stripeCount = 0;
+    int stripeOffset = 0;  // -1: let the MDS choose the first OST
+    string pool;           // OST pool, empty: no pool
+    string placement = "default";  // default | free | bandwidth
+    string ostBwFile;              // per-OST bandwidth, read_test -o output
+    float minFree = 10.f;          // exclude OSTs with less free space (%)
+};
+
+// OST information used to select where stripes are placed
+struct OSTInfo {
+    int index = -1;
+    string uuid;
+    uint64_t freeBytes = 0;
+    float freePercent = 0.f;
+    float bandwidth = -1.f;  // GiB/s, < 0 if not measured
+};
+
+//------------------------------------------------------------------------------
+Config ParseCommandLine(int argc, char** argv) {
+    static const char* HELP_TEXT = R"(
+        Create striped file, the file must not exist already.
+        When a pool is specified the stripe offset is ignored and
+        the OSTs are selected by the MDS among the pool members. E.g.
+        >create_file data/file $((1<<20)) 8 -p flash
+        With '--placement free' or '--placement bandwidth' the OSTs
+        are selected by this program and pinned in the layout:
+        OSTs with less than --min-free % free space are excluded and
+        the remaining ones are ranked by available space or by the
+        bandwidth found in the --ost-bw file, which contains lines
+        in the 'OST <index>: <bandwidth> GiB/s' format printed by
+        read_test -o and pool_test; OSTs without a bandwidth
+        measurement are ranked last, by available space. E.g.
+        >read_test data/wide -o > ost_bw.txt
+        >create_file data/file $((1<<20)) 8 --placement bandwidth \
+         --ost-bw ost_bw.txt
+    )";
+    Config cfg;
+    bool showHelp = false;
+    auto cli =
+        lyra::help(showHelp).description(HELP_TEXT) |
+        lyra::arg(cfg.fileName, "filename")("File name").required() |
+        lyra::arg(cfg.stripeSize, "stripe size")("Stripe size").required() |
+        lyra::arg(cfg.stripeCount, "number of OSTs")("Stripe count")
+            .required() |
+        lyra::opt(cfg.stripeOffset, "stripe offset")["-i"]["--offset"](
+            "Index of first OST, -1 to let the MDS choose")
+            .optional() |
+        lyra::opt(cfg.pool, "pool")["-p"]["--pool"](
+            "OST pool name, 'pool' or 'fsname.pool'")
+            .optional() |
+        lyra::opt(cfg.placement, "placement")["-P"]["--placement"](
+            "OST placement: default (MDS), free, bandwidth")
+            .choices("default", "free", "bandwidth")
+            .optional() |
+        lyra::opt(cfg.ostBwFile, "OST bandwidth file")["-b"]["--ost-bw"](
+            "Per-OST bandwidth file, required by bandwidth placement")
+            .optional() |
+        lyra::opt(cfg.minFree, "min free space")["-m"]["--min-free"](
+            "Minimum OST free space percentage")
+            .optional();
+
+    auto result = cli.parse({argc, argv});
+    if (!result) {
+        cerr << result.errorMessage() << endl;
+        cerr << cli << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (showHelp) {
+        cout << cli;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.stripeSize == 0 || cfg.stripeCount == 0) {
+        cerr << "Invalid stripe size or count" << endl;
+        cout << cli;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.placement == "bandwidth" && cfg.ostBwFile.empty()) {
+        cerr << "Bandwidth placement requires an OST bandwidth file" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return cfg;
+}
+
+//------------------------------------------------------------------------------
+// directory where file is created, statfs requests are sent through it
+string ParentDir(const string& path) {
+    const auto i = path.find_last_of('/');
+    if (i == string::npos) return ".";
+    return i == 0 ? "/" : path.substr(0, i);
+}
+
+// query free space of all active OSTs
+vector<OSTInfo> GetOSTs(const string& path) {
+    vector<char> p(begin(path), end(path));
+    p.push_back('\0');
+    vector<OSTInfo> osts;
+    for (__u32 i = 0;; ++i) {
+        obd_statfs st = {};
+        obd_uuid uuid = {};
+        const int rc = llapi_obd_statfs(p.data(), LL_STATFS_LOV, i, &st, &uuid);
+        if (rc == -ENODEV) break;  // no more OSTs
+        if (rc == -EAGAIN || rc == -ENODATA || rc == -ENOTCONN ||
+            rc == -ETIMEDOUT || rc == -EIO || rc == -ESHUTDOWN) {
+            continue;  // inactive or unreachable
+        }
+        if (rc) {
+            cerr << "Error retrieving OST information: " << strerror(-rc)
+                 << endl;
+            exit(EXIT_FAILURE);
+        }
+        OSTInfo ost;
+        ost.uuid = uuid.uuid;
+        ost.index = OSTIndex(ost.uuid, i);
+        ost.freeBytes = st.os_bavail * st.os_bsize;
+        ost.freePercent =
+            st.os_blocks ? 100.f * st.os_bavail / st.os_blocks : 0.f;
+        osts.push_back(ost);
+    }
+    return osts;
+}
+
+// read per-OST bandwidth, multiple lines for the same OST are averaged;
+// when a line contains more than one number (e.g. write and read bandwidth)
+// the minimum is used
+map<int, float> ReadOSTBandwidth(const string& fname) {
+    ifstream is(fname);
+    if (!is) {
+        cerr << "Cannot open file " << fname << endl;
+        exit(EXIT_FAILURE);
+    }
+    map<int, pair<float, int>> acc;
+    const regex ostRe("OST\\s+([0-9]+)\\s*:(.*)");
+    const regex bwRe("([0-9]*\\.?[0-9]+(?:[eE][-+]?[0-9]+)?)\\s*GiB/s");
+    string line;
+    while (getline(is, line)) {
+        smatch m;
+        if (!regex_search(line, m, ostRe)) continue;
+        const int ost = stoi(m[1]);
+        const string values = m[2];
+        float bw = -1.f;
+        for (sregex_iterator i(begin(values), end(values), bwRe), e; i != e;
+             ++i) {
+            const float v = stof((*i)[1]);
+            bw = bw < 0 ? v : min(bw, v);
+        }
+        if (bw < 0) continue;
+        acc[ost].first += bw;
+        acc[ost].second += 1;
+    }
+    map<int, float> ost2bw;
+    for (const auto& kv : acc) {
+        ost2bw[kv.first] = kv.second.first / kv.second.second;
+    }
+    return ost2bw;
+}
+
+// keep pool members only
+void FilterPool(const string& path, const string& pool,
+                vector<OSTInfo>& osts) {
+    vector<char> fsname(LUSTRE_MAXFSNAME + 1, '\0');
+    const int rc = llapi_search_fsname(path.c_str(), fsname.data());
+    if (rc) {
+        cerr << "Error retrieving filesystem name: " << strerror(-rc) << endl;
+        exit(EXIT_FAILURE);
+    }
+    const string poolName = pool.find('.') == string::npos
+                                ? string(fsname.data()) + "." + pool
+                                : pool;
+    const int MAX_MEMBERS = 4096;
+    vector<char*> members(MAX_MEMBERS);
+    vector<char> buffer(MAX_MEMBERS * 64);
+    const int n = llapi_get_poolmembers(poolName.c_str(), members.data(),
+                                        members.size(), buffer.data(),
+                                        buffer.size());
+    if (n < 0) {
+        cerr << "Error retrieving members of pool " << poolName << ": "
+             << strerror(-n) << endl;
+        exit(EXIT_FAILURE);
+    }
+    vector<int> indices;
+    for (int i = 0; i != n; ++i) indices.push_back(OSTIndex(members[i], -1));
+    osts.erase(remove_if(begin(osts), end(osts),
+                         [&indices](const OSTInfo& o) {
+                             return find(begin(indices), end(indices),
+                                         o.index) == end(indices);
+                         }),
+               end(osts));
+}
+
+// select best 'count' OSTs
+vector<int> SelectOSTs(const Config& config) {
+    const string dir = ParentDir(config.fileName);
+    vector<OSTInfo> osts = GetOSTs(dir);
+    if (!config.pool.empty()) FilterPool(dir, config.pool, osts);
+    osts.erase(remove_if(begin(osts), end(osts),
+                         [&config](const OSTInfo& o) {
+                             return o.freePercent < config.minFree;
+                         }),
+               end(osts));
+    if (osts.size() < config.stripeCount) {
+        cerr << "Not enough OSTs with at least " << config.minFree
+             << "% free space: " << osts.size() << " available, "
+             << config.stripeCount << " requested" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (config.placement == "bandwidth") {
+        const map<int, float> ost2bw = ReadOSTBandwidth(config.ostBwFile);
+        for (auto& o : osts) {
+            auto i = ost2bw.find(o.index);
+            if (i != ost2bw.end()) o.bandwidth = i->second;
+        }
+    }
+    // measured bandwidth first (higher is better), then free space
+    sort(begin(osts), end(osts), [](const OSTInfo& a, const OSTInfo& b) {
+        if (a.bandwidth != b.bandwidth) return a.bandwidth > b.bandwidth;
+        return a.freeBytes > b.freeBytes;
+    });
+    vector<int> selected;
+    for (int i = 0; i != config.stripeCount; ++i) {
+        const OSTInfo& o = osts[i];
+        selected.push_back(o.index);
+        cout << "OST " << o.index << ": " << o.freePercent << "% free";
+        if (o.bandwidth >= 0) cout << ", " << o.bandwidth << " GiB/s";
+        cout << endl;
+    }
+    return selected;
+}
+
+//------------------------------------------------------------------------------
 //important: make sure the file does not exist already
 int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        cerr << "usage: " << argv[0]
-             << " <filename> <stripe size> <number of OSTs>" << endl;
+    const Config config = ParseCommandLine(argc, argv);
+    llapi_layout* layout = llapi_layout_alloc();
+    if (!layout) {
+        cerr << "Error allocating layout: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (llapi_layout_stripe_size_set(layout, config.stripeSize) ||
+        llapi_layout_stripe_count_set(layout, config.stripeCount) ||
+        llapi_layout_pattern_set(layout, LLAPI_LAYOUT_RAID0)) {
+        cerr << "Error setting layout attributes: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (!config.pool.empty()) {
+        if (llapi_layout_pool_name_set(layout, config.pool.c_str())) {
+            cerr << "Error setting pool name: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (config.placement != "default") {
+        const vector<int> osts = SelectOSTs(config);
+        for (int i = 0; i != osts.size(); ++i) {
+            if (llapi_layout_ost_index_set(layout, i, osts[i])) {
+                cerr << "Error setting OST index: " << strerror(errno) << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+    } else if (config.pool.empty() && config.stripeOffset >= 0) {
+        if (llapi_layout_ost_index_set(layout, 0, config.stripeOffset)) {
+            cerr << "Error setting stripe offset: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    const int fd =
+        llapi_layout_file_create(config.fileName.c_str(), O_WRONLY, 0644, layout);
+    llapi_layout_free(layout);
+    if (fd < 0) {
+        cerr << "file creation has failed, error: " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
-    const int rc = llapi_file_create(argv[1], atoll(argv[2]), 0, atoll(argv[3]),
-                                     LOV_PATTERN_RAID0);     
-    if (rc < 0) {
-        cerr << "file creation has failed, error: " << strerror(-rc);
+    if (close(fd)) {
+        cerr << "Error closing file: " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
-    cout << argv[1] << " with stripe size " << atoll(argv[2])
-         << " striped across " << atoll(argv[3]) << " OSTs, has been created!"
-         << endl;
+    cout << config.fileName << " with stripe size " << config.stripeSize
+         << " striped across " << config.stripeCount << " OSTs";
+    if (!config.pool.empty()) cout << " in pool " << config.pool;
+    cout << ", has been created!" << endl;
     return 0;
-}
\ No newline at end of file
+}
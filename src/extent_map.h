@@ -0,0 +1,250 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Extent map: file offset -> OST interval map used to attribute bytes and
+// time to the OSTs actually storing the data.
+// The layout components (PFL) are read through the llapi_layout_comp_*
+// functions; allocated extents are read with FS_IOC_FIEMAP in device order:
+// Lustre returns, for each OST object, extents whose logical offset is
+// relative to the object, which are translated back to file offsets with the
+// RAID0 mapping of the component the object belongs to. fe_device packs the
+// OST index and the absolute stripe number across all the components, which
+// identifies the component stripe even when components reuse an OST.
+// Holes in sparse files are not part of the map.
+// When FIEMAP is not available (e.g. non-Lustre filesystems) the map is
+// built from the layout alone, assuming the file is fully allocated.
+
+#pragma once
+
+#include <lustre/ll_fiemap.h>
+#include <lustre/lustreapi.h>
+#include <sys/ioctl.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// linux/fs.h conflicts with lustre_user.h
+#ifndef FS_IOC_FIEMAP
+#define FS_IOC_FIEMAP _IOWR('f', 11, struct fiemap)
+#endif
+
+// OST id used for holes
+const int64_t HOLE_OST = -1;
+
+// layout component
+struct Component {
+    uint64_t start = 0;
+    uint64_t end = 0;  // LUSTRE_EOF for last component
+    uint64_t stripeSize = 0;
+    std::vector<uint64_t> osts;  // stripe -> OST
+};
+
+// file range [start, end) stored on OST 'ost'
+struct OSTExtent {
+    uint64_t end = 0;
+    int64_t ost = HOLE_OST;
+};
+
+struct ExtentMap {
+    std::map<uint64_t, OSTExtent> extents;  // range start -> extent
+    bool fiemap = false;  // true if built from FIEMAP information
+};
+
+//------------------------------------------------------------------------------
+// instantiated components of layout; empty if layout is not available
+inline std::vector<Component> LayoutComponents(int fd) {
+    std::vector<Component> comps;
+    llapi_layout* layout = llapi_layout_get_by_fd(fd, 0);
+    if (!layout) return comps;
+    int rc = llapi_layout_comp_use(layout, LLAPI_LAYOUT_COMP_USE_FIRST);
+    while (rc == 0) {
+        Component c;
+        uint64_t count = 0;
+        bool ok = !llapi_layout_comp_extent_get(layout, &c.start, &c.end) &&
+                  !llapi_layout_stripe_size_get(layout, &c.stripeSize) &&
+                  !llapi_layout_stripe_count_get(layout, &count);
+        for (uint64_t i = 0; ok && i != count; ++i) {
+            uint64_t ost = 0;
+            // fails for components not instantiated yet: no data stored
+            ok = !llapi_layout_ost_index_get(layout, i, &ost);
+            c.osts.push_back(ost);
+        }
+        if (ok && c.stripeSize && !c.osts.empty()) comps.push_back(c);
+        rc = llapi_layout_comp_use(layout, LLAPI_LAYOUT_COMP_USE_NEXT);
+    }
+    llapi_layout_free(layout);
+    return comps;
+}
+
+// insert range [start, end) on 'ost', merging with previous range if
+// contiguous and on the same OST
+inline void InsertExtent(ExtentMap& em, uint64_t start, uint64_t end,
+                         int64_t ost) {
+    if (start >= end) return;
+    auto i = em.extents.lower_bound(start);
+    if (i != em.extents.begin()) {
+        auto p = std::prev(i);
+        if (p->second.end == start && p->second.ost == ost) {
+            p->second.end = end;
+            return;
+        }
+    }
+    em.extents[start] = {end, ost};
+}
+
+// map object range [objStart, objEnd) of stripe 'stripe' in component 'c'
+// to file ranges
+inline void InsertObjectRange(ExtentMap& em, const Component& c, int stripe,
+                              uint64_t objStart, uint64_t objEnd) {
+    const uint64_t S = c.stripeSize;
+    const uint64_t C = c.osts.size();
+    for (uint64_t o = objStart; o < objEnd;) {
+        const uint64_t len = std::min(S - o % S, objEnd - o);
+        const uint64_t f = (o / S) * S * C + stripe * S + o % S;
+        InsertExtent(em, std::max(f, c.start), std::min(f + len, c.end),
+                     c.osts[stripe]);
+        o += len;
+    }
+}
+
+// build map from layout only, [0, fileSize) assumed fully allocated
+inline void LayoutExtents(ExtentMap& em, const std::vector<Component>& comps,
+                          uint64_t fileSize) {
+    for (const auto& c : comps) {
+        const uint64_t S = c.stripeSize;
+        const uint64_t C = c.osts.size();
+        const uint64_t end = std::min(c.end, fileSize);
+        for (uint64_t f = c.start; f < end;) {
+            const uint64_t len = std::min(S - f % S, end - f);
+            InsertExtent(em, f, f + len, c.osts[(f / S) % C]);
+            f += len;
+        }
+    }
+}
+
+// map one FIEMAP extent to the file ranges of its component stripe; with
+// older Lustre versions which do not pack the stripe number in fe_device
+// the first component stripe on the extent OST is used
+inline void InsertFiemapExtent(ExtentMap& em,
+                               const std::vector<Component>& comps,
+                               fiemap_extent x) {
+    const uint64_t ost = get_fe_device(&x);
+    uint64_t stripe = get_fe_stripenr(&x);
+    for (const auto& c : comps) {
+        if (stripe < c.osts.size()) {
+            if (c.osts[stripe] == ost) {
+                InsertObjectRange(em, c, stripe, x.fe_logical,
+                                  x.fe_logical + x.fe_length);
+                return;
+            }
+            break;  // stripe number not packed
+        }
+        stripe -= c.osts.size();
+    }
+    for (const auto& c : comps) {
+        for (size_t s = 0; s != c.osts.size(); ++s) {
+            if (c.osts[s] != ost) continue;
+            InsertObjectRange(em, c, s, x.fe_logical,
+                              x.fe_logical + x.fe_length);
+            return;
+        }
+    }
+}
+
+// read FIEMAP extents in device order, returns false if not supported
+inline bool FiemapExtents(int fd, ExtentMap& em,
+                          const std::vector<Component>& comps) {
+    const unsigned EXTENT_COUNT = 1024;
+    std::vector<char> buffer(fiemap_count_to_size(EXTENT_COUNT));
+    fiemap* fm = reinterpret_cast<fiemap*>(buffer.data());
+    fm->fm_start = 0;
+    fm->fm_length = ~0ULL;
+    fm->fm_flags = FIEMAP_FLAG_DEVICE_ORDER;
+    fm->fm_extent_count = EXTENT_COUNT;
+    while (true) {
+        if (ioctl(fd, FS_IOC_FIEMAP, fm) < 0) return false;
+        const unsigned n = fm->fm_mapped_extents;
+        if (n == 0) break;
+        for (unsigned e = 0; e != n; ++e) {
+            InsertFiemapExtent(em, comps, fm->fm_extents[e]);
+        }
+        const fiemap_extent last = fm->fm_extents[n - 1];
+        if (last.fe_flags & FIEMAP_EXTENT_LAST) break;
+        // continue from last extent: Lustre reads the device to resume
+        // from in the first extent
+        fm->fm_start = last.fe_logical + last.fe_length;
+        fm->fm_length = ~0ULL;
+        fm->fm_extents[0] = last;
+        fm->fm_mapped_extents = 0;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// build extent map of open file
+inline ExtentMap BuildExtentMap(int fd, uint64_t fileSize) {
+    ExtentMap em;
+    const std::vector<Component> comps = LayoutComponents(fd);
+    if (comps.empty()) return em;
+    em.fiemap = FiemapExtents(fd, em, comps);
+    if (!em.fiemap) {
+        em.extents.clear();
+        LayoutExtents(em, comps, fileSize);
+    }
+    return em;
+}
+
+// add number of bytes in [offset, offset + length) stored on each OST to
+// 'ostBytes'; bytes not mapped (holes) are added to HOLE_OST
+inline void Attribute(const ExtentMap& em, uint64_t offset, uint64_t length,
+                      std::map<int64_t, uint64_t>& ostBytes) {
+    const uint64_t end = offset + length;
+    auto i = em.extents.upper_bound(offset);
+    if (i != em.extents.begin()) --i;
+    uint64_t pos = offset;
+    for (; i != em.extents.end() && i->first < end; ++i) {
+        const uint64_t s = std::max(i->first, pos);
+        const uint64_t e = std::min(i->second.end, end);
+        if (e <= s) continue;
+        if (s > pos) ostBytes[HOLE_OST] += s - pos;
+        ostBytes[i->second.ost] += e - s;
+        pos = e;
+    }
+    if (pos < end) ostBytes[HOLE_OST] += end - pos;
+}
@@ -0,0 +1,86 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// File descriptor strategies, to measure the cost of opening files and of
+// sharing descriptors (locks, metadata) as done by different I/O libraries:
+//   thread:   each worker opens its own descriptor in the timed phase
+//   preopen:  one descriptor per worker, opened before the clock starts
+//   shared:   one descriptor shared by all the workers, opened before the
+//             clock starts
+//   transfer: a descriptor is opened and closed for each transfer
+
+#pragma once
+
+#include <cstdlib>
+#include <string>
+
+enum class FdMode { Thread, PreOpen, Shared, Transfer };
+
+// returns false if 'name' is not a valid mode
+inline bool ParseFdMode(const std::string& name, FdMode& mode) {
+    if (name == "thread")
+        mode = FdMode::Thread;
+    else if (name == "preopen")
+        mode = FdMode::PreOpen;
+    else if (name == "shared")
+        mode = FdMode::Shared;
+    else if (name == "transfer")
+        mode = FdMode::Transfer;
+    else
+        return false;
+    return true;
+}
+
+inline const char* FdModeName(FdMode mode) {
+    switch (mode) {
+        case FdMode::PreOpen:
+            return "preopen";
+        case FdMode::Shared:
+            return "shared";
+        case FdMode::Transfer:
+            return "transfer";
+        default:
+            return "thread";
+    }
+}
+
+// FD_MODE environment variable, 'thread' if not set
+inline bool FdModeFromEnv(FdMode& mode) {
+    const char* m = getenv("FD_MODE");
+    mode = FdMode::Thread;
+    return !m || ParseFdMode(m, mode);
+}
@@ -0,0 +1,285 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Layout cache: file size, stripe size and stripe -> OST map stored in a
+// compact binary file keyed by FID and data version.
+// When many processes read the same file one process per node (SLURM local
+// id 0) fills the cache and the other processes on the node memory-map it
+// read-only, so that layout requests hit the MDS once per node instead of
+// once per process.
+// A cache left by a previous run is reused by the filling process after
+// checking that FID and data version still match; the current job/step id
+// is stored as the cache generation so that the other processes never read
+// a stale cache.
+//
+// File format (native endianness):
+//   LayoutCacheHeader
+//   uint64_t ostIndex[stripeCount]
+
+#pragma once
+
+#include <fcntl.h>
+#include <lustre/lustreapi.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// layout information required by the read/write engines
+struct LayoutInfo {
+    uint64_t fileSize = 0;
+    uint64_t stripeSize = 0;
+    uint64_t stripeCount = 0;
+    std::vector<uint64_t> osts;  // stripe -> OST
+};
+
+const uint32_t LAYOUT_CACHE_MAGIC = 0x4C43414C;  // "LACL"
+const uint32_t LAYOUT_CACHE_VERSION = 1;
+
+struct LayoutCacheHeader {
+    uint32_t magic = LAYOUT_CACHE_MAGIC;
+    uint32_t version = LAYOUT_CACHE_VERSION;
+    uint64_t generation = 0;  // job id << 32 | step id
+    uint64_t fidSeq = 0;
+    uint32_t fidOid = 0;
+    uint32_t fidVer = 0;
+    uint64_t dataVersion = 0;
+    uint64_t fileSize = 0;
+    uint64_t stripeSize = 0;
+    uint64_t stripeCount = 0;
+};
+
+//------------------------------------------------------------------------------
+// query layout from the MDS, file must be open
+inline LayoutInfo QueryLayout(int fd) {
+    llapi_layout* layout = llapi_layout_get_by_fd(fd, 0);
+    if (!layout) {
+        std::cerr << "Error retrieving layout information: " << strerror(errno)
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    LayoutInfo li;
+    if (llapi_layout_stripe_size_get(layout, &li.stripeSize)) {
+        std::cerr << "Error retrieving stripe size information: "
+                  << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (llapi_layout_stripe_count_get(layout, &li.stripeCount)) {
+        std::cerr << "Error retrieving stripe count information: "
+                  << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    li.osts.resize(li.stripeCount);
+    for (uint64_t i = 0; i != li.stripeCount; ++i) {
+        if (llapi_layout_ost_index_get(layout, i, &li.osts[i])) {
+            std::cerr << "Error retrieving OST index: " << strerror(errno)
+                      << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    llapi_layout_free(layout);
+    struct stat st;
+    if (fstat(fd, &st)) {
+        std::cerr << "Error retrieving file size: " << strerror(errno)
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    li.fileSize = st.st_size;
+    return li;
+}
+
+// query layout from the MDS
+inline LayoutInfo QueryLayout(const char* fname) {
+    const int fd = open(fname, O_RDONLY | O_LARGEFILE);
+    if (fd < 0) {
+        std::cerr << "Error opening file: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const LayoutInfo li = QueryLayout(fd);
+    close(fd);
+    return li;
+}
+
+//------------------------------------------------------------------------------
+// current job/step generation, 0 outside of SLURM
+inline uint64_t LayoutCacheGeneration() {
+    const char* jobId = getenv("SLURM_JOB_ID");
+    const char* stepId = getenv("SLURM_STEP_ID");
+    const uint64_t job = jobId ? strtoull(jobId, NULL, 10) : 0;
+    const uint64_t step = stepId ? strtoull(stepId, NULL, 10) : 0;
+    return job << 32 | (step & 0xFFFFFFFF);
+}
+
+// memory-map cache read-only and extract header and layout,
+// returns false if the cache does not exist or is invalid
+inline bool ReadLayoutCache(const std::string& path, LayoutCacheHeader& header,
+                            LayoutInfo& li) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < sizeof(LayoutCacheHeader)) {
+        close(fd);
+        return false;
+    }
+    const char* data = static_cast<const char*>(
+        mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0));
+    close(fd);
+    if (data == MAP_FAILED) return false;
+    memcpy(&header, data, sizeof(header));
+    const bool valid =
+        header.magic == LAYOUT_CACHE_MAGIC &&
+        header.version == LAYOUT_CACHE_VERSION &&
+        st.st_size == sizeof(header) + header.stripeCount * sizeof(uint64_t);
+    if (valid) {
+        const uint64_t* osts =
+            reinterpret_cast<const uint64_t*>(data + sizeof(header));
+        li.fileSize = header.fileSize;
+        li.stripeSize = header.stripeSize;
+        li.stripeCount = header.stripeCount;
+        li.osts.assign(osts, osts + header.stripeCount);
+    }
+    munmap(const_cast<char*>(data), st.st_size);
+    return valid;
+}
+
+// write cache to temporary file then atomically rename
+inline void WriteLayoutCache(const std::string& path,
+                             const LayoutCacheHeader& header,
+                             const LayoutInfo& li) {
+    const std::string tmp = path + ".tmp." + std::to_string(getpid());
+    const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error creating layout cache: " << strerror(errno)
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const size_t ostBytes = li.osts.size() * sizeof(uint64_t);
+    if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+        write(fd, li.osts.data(), ostBytes) != ssize_t(ostBytes)) {
+        std::cerr << "Error writing layout cache: " << strerror(errno)
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (close(fd) || rename(tmp.c_str(), path.c_str())) {
+        std::cerr << "Error writing layout cache: " << strerror(errno)
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+//------------------------------------------------------------------------------
+// fill cache: reuse layout from existing cache if FID and data version match,
+// query the MDS otherwise; always record the current generation
+inline LayoutInfo FillLayoutCache(const char* fname, const std::string& path) {
+    lustre_fid fid;
+    int rc = llapi_path2fid(fname, &fid);
+    if (rc) {
+        std::cerr << "Error retrieving FID: " << strerror(-rc) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const int fd = open(fname, O_RDONLY | O_LARGEFILE);
+    if (fd < 0) {
+        std::cerr << "Error opening file: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    __u64 dataVersion = 0;
+    rc = llapi_get_data_version(fd, &dataVersion, 0);
+    if (rc) {
+        std::cerr << "Error retrieving data version: " << strerror(-rc)
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    LayoutCacheHeader header;
+    LayoutInfo li;
+    const bool hit = ReadLayoutCache(path, header, li) &&
+                     header.fidSeq == fid.f_seq && header.fidOid == fid.f_oid &&
+                     header.fidVer == fid.f_ver &&
+                     header.dataVersion == dataVersion;
+    if (!hit) {
+        li = QueryLayout(fd);
+        header = LayoutCacheHeader();
+        header.fidSeq = fid.f_seq;
+        header.fidOid = fid.f_oid;
+        header.fidVer = fid.f_ver;
+        header.dataVersion = dataVersion;
+        header.fileSize = li.fileSize;
+        header.stripeSize = li.stripeSize;
+        header.stripeCount = li.stripeCount;
+    }
+    close(fd);
+    header.generation = LayoutCacheGeneration();
+    WriteLayoutCache(path, header, li);
+    return li;
+}
+
+// wait for the cache of the current generation to be filled by the
+// process with local id 0, query the MDS directly after timeout
+inline LayoutInfo WaitLayoutCache(const char* fname, const std::string& path,
+                                  float timeoutSeconds = 60.f) {
+    using Clock = std::chrono::steady_clock;
+    const auto start = Clock::now();
+    const uint64_t generation = LayoutCacheGeneration();
+    auto wait = std::chrono::milliseconds(1);
+    while (std::chrono::duration<float>(Clock::now() - start).count() <
+           timeoutSeconds) {
+        LayoutCacheHeader header;
+        LayoutInfo li;
+        if (ReadLayoutCache(path, header, li) &&
+            header.generation == generation) {
+            return li;
+        }
+        std::this_thread::sleep_for(wait);
+        wait = std::min(2 * wait, std::chrono::milliseconds(100));
+    }
+    std::cerr << "Timeout waiting for layout cache, querying MDS" << std::endl;
+    return QueryLayout(fname);
+}
+
+// retrieve layout through cache 'path'
+inline LayoutInfo CachedLayout(const char* fname, const std::string& path) {
+    const char* localId = getenv("SLURM_LOCALID");
+    const bool filler = !localId || strtoul(localId, NULL, 10) == 0;
+    return filler ? FillLayoutCache(fname, path) : WaitLayoutCache(fname, path);
+}
@@ -0,0 +1,333 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Metadata benchmark: each thread creates, stats, opens/closes and unlinks
+// a number of files in its own directory or in a directory shared by all
+// the threads. On Lustre the test directory can be striped across MDTs
+// (DNE) and the stripe setting is inherited by the per-thread directories.
+// Reports aggregate operation rate and per-operation latency percentiles for
+// each phase.
+// Run without arguments to read help text.
+
+#include <fcntl.h>
+#include <lustre/lustreapi.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <lyra/lyra.hpp>
+#include <string>
+#include <vector>
+
+#include "stats.h"
+
+using namespace std;
+
+// constants
+constexpr float us = 1E6;
+
+// default clock
+using Clock = chrono::high_resolution_clock;
+
+// Compute elapsed time
+constexpr float Elapsed(const chrono::duration<float>& d) {
+    return chrono::duration_cast<chrono::microseconds>(d).count() / us;
+}
+
+// Configuration information read from command line
+struct Config {
+    string dir;                 // parent directory
+    int numThreads = 1;         // number of threads
+    size_t filesPerThread = 1000;  // files created by each thread
+    bool shared = false;        // all threads in the same directory
+    int mdtCount = 0;           // DNE stripe count, 0 = plain directory
+    int mdtOffset = -1;         // first MDT, -1 = chosen by MDS
+    bool keep = false;          // do not delete test directories
+};
+
+// metadata operations, in execution order
+enum Phase { CREATE = 0, STAT, OPEN, UNLINK, NUM_PHASES };
+const char* PHASE_NAMES[] = {"create", "stat", "open/close", "unlink"};
+
+// per-phase result
+struct PhaseInfo {
+    float seconds = 0.f;  // wall clock time, all threads
+    size_t ops = 0;       // total number of operations
+    float p50 = 0.f;      // per-operation latency percentiles (us)
+    float p90 = 0.f;
+    float p99 = 0.f;
+    float max = 0.f;
+};
+
+//------------------------------------------------------------------------------
+Config ParseCommandLine(int argc, char** argv) {
+    static const char* HELP_TEXT = R"(
+        Metadata benchmark: each thread creates, stats, opens/closes and
+        unlinks a number of empty files, in a private directory per
+        thread or in a single shared directory. With -c the test
+        directory is striped across MDTs (Lustre DNE) and the same
+        striping is set as default for the per-thread directories;
+        ignored on non-Lustre filesystems. E.g.
+        >md_test /scratch/tmp -t 16 -n 10000 -c 4
+    )";
+    Config cfg;
+    bool showHelp = false;
+    auto cli =
+        lyra::help(showHelp).description(HELP_TEXT) |
+        lyra::arg(cfg.dir, "directory")("Parent directory").required() |
+        lyra::opt(cfg.numThreads, "threads")["-t"]["--threads"](
+            "Number of threads")
+            .optional() |
+        lyra::opt(cfg.filesPerThread, "files")["-n"]["--files"](
+            "Number of files per thread")
+            .optional() |
+        lyra::opt(cfg.shared)["-s"]["--shared"](
+            "All threads use the same directory")
+            .optional() |
+        lyra::opt(cfg.mdtCount, "MDT count")["-c"]["--mdt-count"](
+            "Stripe test directory across MDTs, -1 = all MDTs")
+            .optional() |
+        lyra::opt(cfg.mdtOffset, "MDT index")["-i"]["--mdt-index"](
+            "Index of first MDT")
+            .optional() |
+        lyra::opt(cfg.keep)["-k"]["--keep"]("Do not delete test directories")
+            .optional();
+
+    auto result = cli.parse({argc, argv});
+    if (!result) {
+        cerr << result.errorMessage() << endl;
+        cerr << cli << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (showHelp) {
+        cout << cli;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.numThreads < 1 || cfg.filesPerThread == 0) {
+        cerr << "Number of threads and files must be greater than zero"
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    return cfg;
+}
+
+//------------------------------------------------------------------------------
+bool IsLustre(const string& path) {
+    struct statfs s;
+    if (statfs(path.c_str(), &s)) {
+        cerr << "Cannot access " << path << ": " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return s.f_type == LL_SUPER_MAGIC;
+}
+
+// create test directory, striped across MDTs if requested and supported,
+// returns true if DNE striping was applied
+bool CreateTestDir(const string& dir, const Config& config, bool lustre) {
+    if (lustre && config.mdtCount != 0) {
+        int rc = llapi_dir_create_pool(dir.c_str(), 0755, config.mdtOffset,
+                                       config.mdtCount,
+                                       LMV_HASH_TYPE_FNV_1A_64, nullptr);
+        if (rc == 0) {
+            // inherited by per-thread sub-directories
+            rc = llapi_dir_set_default_lmv_stripe(
+                dir.c_str(), config.mdtOffset, config.mdtCount,
+                LMV_HASH_TYPE_FNV_1A_64, nullptr);
+            if (rc) {
+                cerr << "Error setting default directory stripe: "
+                     << strerror(-rc) << endl;
+                exit(EXIT_FAILURE);
+            }
+            return true;
+        }
+        cerr << "Cannot create striped directory (" << strerror(-rc)
+             << "), using plain directory" << endl;
+    }
+    if (mkdir(dir.c_str(), 0755)) {
+        cerr << "Cannot create directory " << dir << ": " << strerror(errno)
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    return false;
+}
+
+string ThreadDir(const string& testDir, int thread, bool shared) {
+    return shared ? testDir : testDir + "/t" + to_string(thread);
+}
+
+string TestFileName(const string& dir, int thread, size_t i) {
+    return dir + "/f." + to_string(thread) + "." + to_string(i);
+}
+
+//------------------------------------------------------------------------------
+// execute one operation on all the files of a thread, return per-operation
+// latency in microseconds
+vector<float> ThreadOps(Phase phase, const string& dir, int thread,
+                        size_t numFiles) {
+    vector<float> latency;
+    latency.reserve(numFiles);
+    struct stat st;
+    for (size_t i = 0; i != numFiles; ++i) {
+        const string fname = TestFileName(dir, thread, i);
+        const auto t = Clock::now();
+        int rc = 0;
+        switch (phase) {
+            case CREATE: {
+                const int fd =
+                    open(fname.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+                rc = fd < 0 ? -1 : close(fd);
+            } break;
+            case STAT:
+                rc = stat(fname.c_str(), &st);
+                break;
+            case OPEN: {
+                const int fd = open(fname.c_str(), O_RDONLY);
+                rc = fd < 0 ? -1 : close(fd);
+            } break;
+            case UNLINK:
+                rc = unlink(fname.c_str());
+                break;
+            default:
+                break;
+        }
+        latency.push_back(us * Elapsed(Clock::now() - t));
+        if (rc) {
+            cerr << "Error in " << PHASE_NAMES[phase] << " " << fname << ": "
+                 << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    return latency;
+}
+
+// run one phase on all threads; threads are joined at the end of each
+// phase so that the phases do not overlap
+PhaseInfo RunPhase(Phase phase, const string& testDir, const Config& config) {
+    vector<future<vector<float>>> workers(config.numThreads);
+    const auto start = Clock::now();
+    for (int t = 0; t != config.numThreads; ++t) {
+        workers[t] =
+            async(launch::async, ThreadOps, phase,
+                  ThreadDir(testDir, t, config.shared), t,
+                  config.filesPerThread);
+    }
+    vector<float> latency;
+    latency.reserve(config.numThreads * config.filesPerThread);
+    for (auto& w : workers) {
+        const vector<float> l = w.get();
+        latency.insert(end(latency), begin(l), end(l));
+    }
+    PhaseInfo pi;
+    pi.seconds = Elapsed(Clock::now() - start);
+    pi.ops = latency.size();
+    pi.p50 = Percentile(latency, 50);
+    pi.p90 = Percentile(latency, 90);
+    pi.p99 = Percentile(latency, 99);
+    pi.max = *max_element(begin(latency), end(latency));
+    return pi;
+}
+
+// print one row per phase; the unlink phase is not run with -k
+void PrintResults(const vector<PhaseInfo>& results, bool keep) {
+    cout << "Rate in operations/s, latency in us" << endl;
+    cout << setw(12) << "phase" << setw(12) << "ops/s" << setw(10) << "p50"
+         << setw(10) << "p90" << setw(10) << "p99" << setw(10) << "max"
+         << endl;
+    cout << fixed << setprecision(1);
+    for (int p = 0; p != NUM_PHASES; ++p) {
+        if (keep && p == UNLINK) continue;  // not run
+        const PhaseInfo& r = results[p];
+        cout << setw(12) << PHASE_NAMES[p] << setw(12)
+             << (r.seconds > 0 ? r.ops / r.seconds : 0.f) << setw(10) << r.p50
+             << setw(10) << r.p90 << setw(10) << r.p99 << setw(10) << r.max
+             << endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    const Config config = ParseCommandLine(argc, argv);
+    const bool lustre = IsLustre(config.dir);
+    const string testDir = config.dir + "/md_test." + to_string(getpid());
+    const bool striped = CreateTestDir(testDir, config, lustre);
+    if (!config.shared) {
+        for (int t = 0; t != config.numThreads; ++t) {
+            const string d = ThreadDir(testDir, t, false);
+            if (mkdir(d.c_str(), 0755)) {
+                cerr << "Cannot create directory " << d << ": "
+                     << strerror(errno) << endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    cout << "Filesystem:       " << (lustre ? "Lustre" : "other") << endl;
+    cout << "Directory:        "
+         << (striped ? "striped across " + to_string(config.mdtCount) +
+                           " MDTs"
+                     : string("plain"))
+         << ", " << (config.shared ? "shared" : "one per thread") << endl;
+    cout << "Threads:          " << config.numThreads << endl;
+    cout << "Files per thread: " << config.filesPerThread << endl << endl;
+    vector<PhaseInfo> results(NUM_PHASES);
+    for (int p = 0; p != NUM_PHASES; ++p) {
+        if (config.keep && p == UNLINK) continue;
+        results[p] = RunPhase(Phase(p), testDir, config);
+    }
+    if (!config.keep) {
+        if (!config.shared) {
+            for (int t = 0; t != config.numThreads; ++t) {
+                const string d = ThreadDir(testDir, t, false);
+                if (rmdir(d.c_str())) {
+                    cerr << "Error deleting directory " << d << ": "
+                         << strerror(errno) << endl;
+                }
+            }
+        }
+        if (rmdir(testDir.c_str())) {
+            cerr << "Error deleting directory " << testDir << ": "
+                 << strerror(errno) << endl;
+        }
+    }
+    PrintResults(results, config.keep);
+    return 0;
+}
@@ -0,0 +1,398 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Per-OST health scan: one single-stripe file is created on each OST and
+// written then read back, either on all the OSTs in parallel or one OST at a
+// time. Output is a table ranked by bandwidth with per-transfer latency
+// percentiles; OSTs much slower than the median are flagged.
+// Meant to replace the dd based scripts in osts_tests.
+// Run without arguments to read help text.
+
+#include <fcntl.h>
+#include <lustre/lustreapi.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <lyra/lyra.hpp>
+#include <string>
+#include <vector>
+
+#include "ost_index.h"
+#include "stats.h"
+
+using namespace std;
+
+// constants
+const uint32_t GiB = 1073741824;
+constexpr float us = 1E6;
+
+// default clock
+using Clock = chrono::high_resolution_clock;
+
+// Compute elapsed time
+constexpr float Elapsed(const chrono::duration<float>& d) {
+    return chrono::duration_cast<chrono::microseconds>(d).count() / us;
+}
+
+// Compute bandwidth
+constexpr float GiBs(float seconds, size_t numBytes) {
+    return seconds > 0 ? (numBytes / seconds) / GiB : 0;
+}
+
+// Configuration information read from command line
+struct Config {
+    string dir;                        // scan directory, must be on Lustre
+    size_t bytesPerOST = GiB;          // bytes written/read per OST
+    size_t transferSize = 1 << 20;     // bytes per pwrite/pread call
+    bool parallel = true;              // all OSTs at once or one at a time
+    float outlierFraction = 0.7f;      // flag if bw < fraction x median
+    bool direct = false;               // O_DIRECT
+    bool keep = false;                 // do not delete test files
+};
+
+// write or read test result
+struct PhaseInfo {
+    float bandwidth = 0.f;  // GiB/s
+    float p50 = 0.f;        // per-transfer latency percentiles (ms)
+    float p90 = 0.f;
+    float p99 = 0.f;
+    float max = 0.f;
+};
+
+// per-OST result
+struct OSTResult {
+    int ost = -1;
+    bool available = false;
+    PhaseInfo write;
+    PhaseInfo read;
+    string flags;
+};
+
+//------------------------------------------------------------------------------
+Config ParseCommandLine(int argc, char** argv) {
+    static const char* HELP_TEXT = R"(
+        Per-OST health scan: create one single-stripe file per OST in
+        the scan directory, write and read it back measuring bandwidth
+        and per-transfer latency. OSTs are tested all at once (parallel)
+        or one at a time (sequential); sequential mode measures each OST
+        in isolation, parallel mode measures OSTs under full load.
+        Flags: W/R write/read bandwidth < fraction x median,
+               L p99 latency > median p99 / fraction,
+               X OST unavailable. E.g.
+        >ost_scan /scratch/tmp/scan -s $((2*2**30)) -m sequential
+    )";
+    Config cfg;
+    bool showHelp = false;
+    string mode = "parallel";
+    auto cli =
+        lyra::help(showHelp).description(HELP_TEXT) |
+        lyra::arg(cfg.dir, "directory")("Scan directory").required() |
+        lyra::opt(cfg.bytesPerOST, "bytes per OST")["-s"]["--size"](
+            "Number of bytes written to and read from each OST")
+            .optional() |
+        lyra::opt(cfg.transferSize, "transfer size")["-t"]["--transfer-size"](
+            "Bytes per read/write call")
+            .optional() |
+        lyra::opt(mode, "mode")["-m"]["--mode"](
+            "parallel: all OSTs at once, sequential: one OST at a time")
+            .choices("parallel", "sequential")
+            .optional() |
+        lyra::opt(cfg.outlierFraction, "outlier fraction")["-f"]["--fraction"](
+            "Flag OSTs with bandwidth < fraction x median")
+            .optional() |
+        lyra::opt(cfg.direct)["-d"]["--direct"]("Use O_DIRECT")
+            .optional() |
+        lyra::opt(cfg.keep)["-k"]["--keep"]("Do not delete test files")
+            .optional();
+
+    auto result = cli.parse({argc, argv});
+    if (!result) {
+        cerr << result.errorMessage() << endl;
+        cerr << cli << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (showHelp) {
+        cout << cli;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.transferSize == 0 || cfg.bytesPerOST < cfg.transferSize) {
+        cerr << "Size per OST must be greater than transfer size" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.outlierFraction <= 0.f || cfg.outlierFraction > 1.f) {
+        cerr << "Outlier fraction must be in (0, 1]" << endl;
+        exit(EXIT_FAILURE);
+    }
+    // whole transfers only
+    cfg.bytesPerOST -= cfg.bytesPerOST % cfg.transferSize;
+    cfg.parallel = mode == "parallel";
+    return cfg;
+}
+
+//------------------------------------------------------------------------------
+string ScanFileName(const Config& config, int ost) {
+    return config.dir + "/ost_scan." + to_string(ost) + "." +
+           to_string(getpid());
+}
+
+// create single stripe file on OST 'ost', returns false if the OST is not
+// available
+bool CreateOSTFile(const string& fname, int ost, size_t stripeSize) {
+    llapi_layout* layout = llapi_layout_alloc();
+    if (!layout || llapi_layout_stripe_count_set(layout, 1) ||
+        llapi_layout_stripe_size_set(layout, stripeSize) ||
+        llapi_layout_ost_index_set(layout, 0, ost)) {
+        cerr << "Error setting layout attributes: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    const int fd =
+        llapi_layout_file_create(fname.c_str(), O_WRONLY, 0644, layout);
+    llapi_layout_free(layout);
+    if (fd < 0) {
+        cerr << "Cannot create file on OST " << ost << ": " << strerror(errno)
+             << endl;
+        return false;
+    }
+    if (close(fd)) {
+        cerr << "Error closing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// write or read whole file recording the latency of each transfer;
+// write time includes fsync
+PhaseInfo OSTIO(const string& fname, bool write, size_t size,
+                size_t transferSize, bool direct) {
+    const int flags = (write ? O_WRONLY : O_RDONLY) | O_LARGEFILE |
+                      (direct ? O_DIRECT : 0);
+    const int fd = open(fname.c_str(), flags);
+    if (fd < 0) {
+        cerr << "Error opening file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    char* buffer =
+        static_cast<char*>(aligned_alloc(getpagesize(), transferSize));
+    if (!buffer) {
+        cerr << "Failed to allocate memory. Error: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    fill(buffer, buffer + transferSize, 'x');
+    vector<float> latency;
+    latency.reserve(size / transferSize);
+    const auto start = Clock::now();
+    for (size_t off = 0; off < size; off += transferSize) {
+        const auto t = Clock::now();
+        const ssize_t b = write ? pwrite(fd, buffer, transferSize, off)
+                                : pread(fd, buffer, transferSize, off);
+        if (b != ssize_t(transferSize)) {
+            cerr << "Error " << (write ? "writing to" : "reading from")
+                 << " file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        latency.push_back(1000 * Elapsed(Clock::now() - t));
+    }
+    if (write && fsync(fd)) {
+        cerr << "Error syncing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    const auto end = Clock::now();
+    // drop cached pages so that the read phase hits the OST
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    free(buffer);
+    if (close(fd)) {
+        cerr << "Error closing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    PhaseInfo pi;
+    pi.bandwidth = GiBs(Elapsed(end - start), size);
+    pi.p50 = Percentile(latency, 50);
+    pi.p90 = Percentile(latency, 90);
+    pi.p99 = Percentile(latency, 99);
+    pi.max = *max_element(std::begin(latency), std::end(latency));
+    return pi;
+}
+
+// run write or read phase on all available OSTs
+void RunPhase(const Config& config, bool write, vector<OSTResult>& results) {
+    if (config.parallel) {
+        vector<future<PhaseInfo>> workers(results.size());
+        for (int i = 0; i != results.size(); ++i) {
+            if (!results[i].available) continue;
+            workers[i] = async(launch::async, OSTIO,
+                               ScanFileName(config, results[i].ost), write,
+                               config.bytesPerOST, config.transferSize,
+                               config.direct);
+        }
+        for (int i = 0; i != results.size(); ++i) {
+            if (!workers[i].valid()) continue;
+            (write ? results[i].write : results[i].read) = workers[i].get();
+        }
+    } else {
+        for (auto& r : results) {
+            if (!r.available) continue;
+            (write ? r.write : r.read) =
+                OSTIO(ScanFileName(config, r.ost), write, config.bytesPerOST,
+                      config.transferSize, config.direct);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+// set outlier flags and sort by bandwidth, slowest last
+void Rank(vector<OSTResult>& results, float fraction) {
+    vector<float> wbw, rbw, wp99, rp99;
+    for (const auto& r : results) {
+        if (!r.available) continue;
+        wbw.push_back(r.write.bandwidth);
+        rbw.push_back(r.read.bandwidth);
+        wp99.push_back(r.write.p99);
+        rp99.push_back(r.read.p99);
+    }
+    const float mw = Median(wbw);
+    const float mr = Median(rbw);
+    const float mwl = Median(wp99);
+    const float mrl = Median(rp99);
+    for (auto& r : results) {
+        if (!r.available) {
+            r.flags = "X";
+            continue;
+        }
+        if (r.write.bandwidth < fraction * mw) r.flags += "W";
+        if (r.read.bandwidth < fraction * mr) r.flags += "R";
+        if (r.write.p99 > mwl / fraction || r.read.p99 > mrl / fraction)
+            r.flags += "L";
+    }
+    stable_sort(begin(results), end(results),
+                [](const OSTResult& a, const OSTResult& b) {
+                    return min(a.write.bandwidth, a.read.bandwidth) >
+                           min(b.write.bandwidth, b.read.bandwidth);
+                });
+}
+
+void PrintResults(const vector<OSTResult>& results) {
+    cout << "Bandwidth in GiB/s, latency in ms" << endl;
+    cout << setw(6) << "rank" << setw(6) << "OST" << setw(10) << "write"
+         << setw(10) << "read" << setw(10) << "w p50" << setw(10) << "w p90"
+         << setw(10) << "w p99" << setw(10) << "w max" << setw(10) << "r p50"
+         << setw(10) << "r p90" << setw(10) << "r p99" << setw(10) << "r max"
+         << "  flags" << endl;
+    int rank = 1;
+    cout << fixed << setprecision(3);
+    for (const auto& r : results) {
+        cout << setw(6) << rank++ << setw(6) << r.ost << setw(10)
+             << r.write.bandwidth << setw(10) << r.read.bandwidth << setw(10)
+             << r.write.p50 << setw(10) << r.write.p90 << setw(10)
+             << r.write.p99 << setw(10) << r.write.max << setw(10)
+             << r.read.p50 << setw(10) << r.read.p90 << setw(10) << r.read.p99
+             << setw(10) << r.read.max << "  " << r.flags << endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+// OSTs of the filesystem containing 'path': indices are not contiguous when
+// OSTs have been removed; inactive or unreachable OSTs are returned as not
+// available
+vector<OSTResult> GetOSTs(const string& path) {
+    vector<char> p(begin(path), end(path));
+    p.push_back('\0');
+    vector<OSTResult> osts;
+    for (__u32 i = 0;; ++i) {
+        obd_statfs st = {};
+        obd_uuid uuid = {};
+        const int rc = llapi_obd_statfs(p.data(), LL_STATFS_LOV, i, &st, &uuid);
+        if (rc == -ENODEV) break;     // no more OSTs
+        if (rc == -ENODATA) continue;  // no OST at this index
+        OSTResult r;
+        r.ost = OSTIndex(uuid.uuid, i);
+        if (rc == -EAGAIN || rc == -ENOTCONN || rc == -ETIMEDOUT ||
+            rc == -EIO || rc == -ESHUTDOWN) {
+            r.available = false;  // inactive or unreachable
+        } else if (rc) {
+            cerr << "Error retrieving OST information: " << strerror(-rc)
+                 << endl;
+            exit(EXIT_FAILURE);
+        } else {
+            r.available = true;
+        }
+        osts.push_back(r);
+    }
+    return osts;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    const Config config = ParseCommandLine(argc, argv);
+    vector<OSTResult> results = GetOSTs(config.dir);
+    if (results.empty()) {
+        cerr << "No OSTs found" << endl;
+        exit(EXIT_FAILURE);
+    }
+    cout << "OSTs:          " << results.size() << endl;
+    cout << "Bytes per OST: " << config.bytesPerOST << endl;
+    cout << "Transfer size: " << config.transferSize << endl;
+    cout << "Mode:          " << (config.parallel ? "parallel" : "sequential")
+         << endl
+         << endl;
+    for (auto& r : results) {
+        r.available = r.available && CreateOSTFile(ScanFileName(config, r.ost),
+                                                   r.ost, config.transferSize);
+    }
+    RunPhase(config, true, results);
+    RunPhase(config, false, results);
+    if (!config.keep) {
+        for (const auto& r : results) {
+            if (!r.available) continue;
+            const string fname = ScanFileName(config, r.ost);
+            if (unlink(fname.c_str())) {
+                cerr << "Error deleting file " << fname << ": "
+                     << strerror(errno) << endl;
+            }
+        }
+    }
+    Rank(results, config.outlierFraction);
+    PrintResults(results);
+    return 0;
+}
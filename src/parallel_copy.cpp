@@ -0,0 +1,303 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Stripe-parallel file copy: the destination is created with the source
+// layout or with a layout chosen on the command line, and the copy is split
+// into stripe-aligned chunks, one worker per destination stripe so that
+// each worker writes to a single OST.
+// Only plain (single component) layouts are replicated: a PFL source is
+// rejected unless both stripe size and count are specified, in which case
+// the destination is created with a plain layout.
+// Data is moved in the kernel with copy_file_range when supported; the
+// fallback is pread/pwrite through a bounded per-worker buffer.
+// Run without arguments to read help text.
+
+#include <fcntl.h>
+#include <lustre/lustreapi.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <lyra/lyra.hpp>
+#include <string>
+#include <vector>
+
+#include "layout_cache.h"
+
+using namespace std;
+
+// constants
+const uint32_t GiB = 1073741824;
+const size_t MAX_BUFFER_SIZE = 1 << 26;  // fallback buffer size cap
+constexpr float us = 1E6;
+
+// default clock
+using Clock = chrono::high_resolution_clock;
+
+// Compute elapsed time
+constexpr float Elapsed(const chrono::duration<float>& d) {
+    return chrono::duration_cast<chrono::microseconds>(d).count() / us;
+}
+
+// Compute bandwidth
+constexpr float GiBs(float seconds, size_t numBytes) {
+    return seconds > 0 ? (numBytes / seconds) / GiB : 0;
+}
+
+// Configuration information read from command line
+struct Config {
+    string source;
+    string destination;
+    uint64_t stripeSize = 0;   // 0 = same as source
+    uint64_t stripeCount = 0;  // 0 = same as source
+    string pool;               // OST pool for destination
+    bool noCopyRange = false;  // always use buffered fallback
+};
+
+// set to false by the first worker which finds copy_file_range unsupported
+atomic<bool> useCopyRange(true);
+
+//------------------------------------------------------------------------------
+Config ParseCommandLine(int argc, char** argv) {
+    static const char* HELP_TEXT = R"(
+        Stripe-parallel file copy: create the destination file with the
+        same layout as the source or with the specified stripe size,
+        count and pool, then copy stripe-aligned chunks with one thread
+        per destination stripe. The destination must not exist.
+        PFL (composite layout) sources are not replicated: they are
+        rejected unless both -S and -c are specified, the destination
+        then has a plain layout. E.g.
+        >parallel_copy /scratch/p1/data /scratch/p2/data -c 16
+    )";
+    Config cfg;
+    bool showHelp = false;
+    auto cli =
+        lyra::help(showHelp).description(HELP_TEXT) |
+        lyra::arg(cfg.source, "source")("Source file").required() |
+        lyra::arg(cfg.destination, "destination")("Destination file")
+            .required() |
+        lyra::opt(cfg.stripeSize, "stripe size")["-S"]["--stripe-size"](
+            "Destination stripe size, default: same as source")
+            .optional() |
+        lyra::opt(cfg.stripeCount, "stripe count")["-c"]["--stripe-count"](
+            "Destination stripe count, default: same as source")
+            .optional() |
+        lyra::opt(cfg.pool, "pool")["-p"]["--pool"]("Destination OST pool")
+            .optional() |
+        lyra::opt(cfg.noCopyRange)["-b"]["--buffered"](
+            "Do not use copy_file_range")
+            .optional();
+
+    auto result = cli.parse({argc, argv});
+    if (!result) {
+        cerr << result.errorMessage() << endl;
+        cerr << cli << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (showHelp) {
+        cout << cli;
+        exit(EXIT_FAILURE);
+    }
+    return cfg;
+}
+
+//------------------------------------------------------------------------------
+// true if file has more than one layout component (PFL)
+bool IsComposite(const string& path) {
+    llapi_layout* layout = llapi_layout_get_by_path(path.c_str(), 0);
+    if (!layout) {
+        cerr << "Error retrieving layout information: " << strerror(errno)
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    const bool composite =
+        llapi_layout_comp_use(layout, LLAPI_LAYOUT_COMP_USE_FIRST) == 0 &&
+        llapi_layout_comp_use(layout, LLAPI_LAYOUT_COMP_USE_NEXT) == 0;
+    llapi_layout_free(layout);
+    return composite;
+}
+
+//------------------------------------------------------------------------------
+// create destination file and set its size, returns destination layout
+LayoutInfo CreateDestination(const Config& config, const LayoutInfo& src) {
+    LayoutInfo dst;
+    dst.fileSize = src.fileSize;
+    dst.stripeSize = config.stripeSize ? config.stripeSize : src.stripeSize;
+    dst.stripeCount =
+        config.stripeCount ? config.stripeCount : src.stripeCount;
+    llapi_layout* layout = llapi_layout_alloc();
+    if (!layout || llapi_layout_stripe_size_set(layout, dst.stripeSize) ||
+        llapi_layout_stripe_count_set(layout, dst.stripeCount) ||
+        (!config.pool.empty() &&
+         llapi_layout_pool_name_set(layout, config.pool.c_str()))) {
+        cerr << "Error setting layout attributes: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    const int fd = llapi_layout_file_create(config.destination.c_str(),
+                                            O_WRONLY, 0644, layout);
+    llapi_layout_free(layout);
+    if (fd < 0) {
+        cerr << "Cannot create file " << config.destination << ": "
+             << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    // size set upfront so that workers can write in any order
+    if (ftruncate(fd, dst.fileSize)) {
+        cerr << "Error setting file size: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (close(fd)) {
+        cerr << "Error closing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return dst;
+}
+
+//------------------------------------------------------------------------------
+// copy [offset, offset + size) with copy_file_range, returns false if not
+// supported for this pair of files
+bool CopyRange(int in, int out, size_t offset, size_t size) {
+    loff_t inOff = offset;
+    loff_t outOff = offset;
+    while (size > 0) {
+        const ssize_t b = copy_file_range(in, &inOff, out, &outOff, size, 0);
+        if (b < 0) {
+            // not implemented, cross filesystem (kernel < 5.3) or not
+            // supported by the filesystem
+            if (errno == ENOSYS || errno == EXDEV || errno == EOPNOTSUPP ||
+                errno == EINVAL)
+                return false;
+            cerr << "Error copying data: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (b == 0) {
+            cerr << "Unexpected end of file" << endl;
+            exit(EXIT_FAILURE);
+        }
+        size -= b;
+    }
+    return true;
+}
+
+// copy [offset, offset + size) through user space buffer
+void CopyBuffered(int in, int out, size_t offset, size_t size,
+                  vector<char>& buffer) {
+    while (size > 0) {
+        const size_t n = min(size, buffer.size());
+        const ssize_t r = pread(in, buffer.data(), n, offset);
+        if (r <= 0) {
+            cerr << "Error reading from file: "
+                 << (r < 0 ? strerror(errno) : "unexpected end of file")
+                 << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (pwrite(out, buffer.data(), r, offset) != r) {
+            cerr << "Error writing to file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        offset += r;
+        size -= r;
+    }
+}
+
+// copy all the stripe units of destination stripe 'stripe'
+void CopyStripe(const Config& config, const LayoutInfo& dst, int stripe) {
+    const int in = open(config.source.c_str(), O_RDONLY | O_LARGEFILE);
+    const int out = open(config.destination.c_str(), O_WRONLY | O_LARGEFILE);
+    if (in < 0 || out < 0) {
+        cerr << "Error opening file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    vector<char> buffer;
+    const size_t step = dst.stripeSize * dst.stripeCount;
+    for (size_t offset = stripe * dst.stripeSize; offset < dst.fileSize;
+         offset += step) {
+        const size_t size = min(dst.stripeSize, dst.fileSize - offset);
+        if (useCopyRange && CopyRange(in, out, offset, size)) continue;
+        useCopyRange = false;
+        if (buffer.empty()) buffer.resize(min(dst.stripeSize, MAX_BUFFER_SIZE));
+        CopyBuffered(in, out, offset, size, buffer);
+    }
+    if (fsync(out)) {
+        cerr << "Error syncing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (close(in) || close(out)) {
+        cerr << "Error closing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    const Config config = ParseCommandLine(argc, argv);
+    if (config.noCopyRange) useCopyRange = false;
+    // stripe size and count of a composite layout are the ones of the first
+    // component only, copying them would silently flatten the layout
+    if ((!config.stripeSize || !config.stripeCount) &&
+        IsComposite(config.source)) {
+        cerr << "Source has a composite (PFL) layout, specify both stripe "
+                "size and count for a plain destination layout"
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    const LayoutInfo src = QueryLayout(config.source.c_str());
+    const LayoutInfo dst = CreateDestination(config, src);
+    cout << "File size:    " << src.fileSize << endl;
+    cout << "Source:       " << src.stripeCount << " x " << src.stripeSize
+         << endl;
+    cout << "Destination:  " << dst.stripeCount << " x " << dst.stripeSize
+         << endl;
+    const auto start = Clock::now();
+    vector<future<void>> workers(dst.stripeCount);
+    for (int s = 0; s != workers.size(); ++s) {
+        workers[s] =
+            async(launch::async, CopyStripe, cref(config), cref(dst), s);
+    }
+    for (auto& w : workers) w.get();
+    const float seconds = Elapsed(Clock::now() - start);
+    cout << "Method:       "
+         << (useCopyRange ? "copy_file_range" : "buffered") << endl;
+    cout << "Elapsed time: " << seconds << " s" << endl;
+    cout << "Bandwidth:    " << GiBs(seconds, src.fileSize) << " GiB/s"
+         << endl;
+    return 0;
+}
@@ -0,0 +1,342 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Per-pool bandwidth test: for each OST pool create a file striped across
+// all the pool members, write and read it back with one thread per stripe,
+// each thread accessing only the stripe units stored on a single OST.
+// Aggregate and per-OST bandwidth is reported for each pool.
+// Run without arguments to read help text.
+
+#include <fcntl.h>
+#include <lustre/lustreapi.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <lyra/lyra.hpp>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// constants
+const uint32_t GiB = 1073741824;
+constexpr float us = 1E6;
+const int MAX_POOLS = 256;
+const int MAX_POOL_MEMBERS = 4096;
+
+// default clock
+using Clock = chrono::high_resolution_clock;
+
+// Compute elapsed time
+constexpr float Elapsed(const chrono::duration<float>& d) {
+    return chrono::duration_cast<chrono::microseconds>(d).count() / us;
+}
+
+// Compute bandwidth
+constexpr float GiBs(float seconds, size_t numBytes) {
+    return seconds > 0 ? (numBytes / seconds) / GiB : 0;
+}
+
+// Configuration information read from command line
+struct Config {
+    string dir;                   // test directory, must be on Lustre
+    string pool;                  // test only this pool, empty: all pools
+    size_t bytesPerOST = GiB;     // bytes written to/read from each OST
+    uint64_t stripeSize = 1 << 20;
+    bool keep = false;            // do not delete test files
+};
+
+// OST pool
+struct Pool {
+    string name;             // fsname.poolname
+    vector<string> members;  // OST names
+};
+
+// per-stripe I/O performance
+struct IOInfo {
+    size_t bytes = 0;
+    float seconds = 0.f;
+};
+
+// per-pool test result
+struct PoolResult {
+    vector<uint64_t> osts;  // stripe -> OST index
+    vector<IOInfo> write;
+    vector<IOInfo> read;
+    float writeBw = 0.f;  // aggregate
+    float readBw = 0.f;
+};
+
+//------------------------------------------------------------------------------
+Config ParseCommandLine(int argc, char** argv) {
+    static const char* HELP_TEXT = R"(
+        Compute per-pool aggregate and per-OST bandwidth: one file per
+        pool is created in the test directory, striped across all the
+        pool members, with one thread per stripe. E.g.
+        >pool_test /scratch/project/tmp -s $((4*2**30))
+    )";
+    Config cfg;
+    bool showHelp = false;
+    auto cli =
+        lyra::help(showHelp).description(HELP_TEXT) |
+        lyra::arg(cfg.dir, "directory")("Test directory").required() |
+        lyra::opt(cfg.pool, "pool")["-p"]["--pool"](
+            "Only test pool, 'pool' or 'fsname.pool'")
+            .optional() |
+        lyra::opt(cfg.bytesPerOST, "bytes per OST")["-s"]["--size"](
+            "Number of bytes written to and read from each OST")
+            .optional() |
+        lyra::opt(cfg.stripeSize, "stripe size")["-S"]["--stripe-size"](
+            "Stripe size, also used as transfer size")
+            .optional() |
+        lyra::opt(cfg.keep)["-k"]["--keep"]("Do not delete test files")
+            .optional();
+
+    auto result = cli.parse({argc, argv});
+    if (!result) {
+        cerr << result.errorMessage() << endl;
+        cerr << cli << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (showHelp) {
+        cout << cli;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.stripeSize == 0 || cfg.bytesPerOST < cfg.stripeSize) {
+        cerr << "Size per OST must be greater than stripe size" << endl;
+        exit(EXIT_FAILURE);
+    }
+    // whole stripes only
+    cfg.bytesPerOST -= cfg.bytesPerOST % cfg.stripeSize;
+    return cfg;
+}
+
+//------------------------------------------------------------------------------
+// retrieve pools and pool members of filesystem containing 'path'
+vector<Pool> GetPools(const string& path) {
+    vector<char*> list(MAX_POOLS);
+    vector<char> buffer(MAX_POOLS * (LOV_MAXPOOLNAME + 64));
+    const int numPools = llapi_get_poollist(path.c_str(), list.data(),
+                                            list.size(), buffer.data(),
+                                            buffer.size());
+    if (numPools < 0) {
+        cerr << "Error retrieving pool list: " << strerror(-numPools) << endl;
+        exit(EXIT_FAILURE);
+    }
+    vector<Pool> pools;
+    vector<char*> members(MAX_POOL_MEMBERS);
+    vector<char> memberBuffer(MAX_POOL_MEMBERS * 64);
+    for (int p = 0; p != numPools; ++p) {
+        const int n = llapi_get_poolmembers(list[p], members.data(),
+                                            members.size(), memberBuffer.data(),
+                                            memberBuffer.size());
+        if (n < 0) {
+            cerr << "Error retrieving members of pool " << list[p] << ": "
+                 << strerror(-n) << endl;
+            exit(EXIT_FAILURE);
+        }
+        pools.push_back({list[p], vector<string>(begin(members),
+                                                  begin(members) + n)});
+    }
+    return pools;
+}
+
+// pool name without "fsname." prefix
+string PoolName(const string& name) {
+    const auto i = name.find('.');
+    return i == string::npos ? name : name.substr(i + 1);
+}
+
+//------------------------------------------------------------------------------
+// create file striped across all pool members and return stripe -> OST map
+vector<uint64_t> CreatePoolFile(const string& fname, const string& pool,
+                                uint64_t stripeSize, uint64_t stripeCount) {
+    llapi_layout* layout = llapi_layout_alloc();
+    if (!layout || llapi_layout_stripe_size_set(layout, stripeSize) ||
+        llapi_layout_stripe_count_set(layout, stripeCount) ||
+        llapi_layout_pool_name_set(layout, pool.c_str())) {
+        cerr << "Error setting layout attributes: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    const int fd = llapi_layout_file_create(fname.c_str(), O_WRONLY, 0644,
+                                            layout);
+    llapi_layout_free(layout);
+    if (fd < 0) {
+        cerr << "Error creating file " << fname << ": " << strerror(errno)
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    layout = llapi_layout_get_by_fd(fd, 0);
+    if (!layout) {
+        cerr << "Error retrieving layout information: " << strerror(errno)
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    vector<uint64_t> osts(stripeCount);
+    for (int i = 0; i != stripeCount; ++i) {
+        if (llapi_layout_ost_index_get(layout, i, &osts[i])) {
+            cerr << "Error retrieving OST index: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    llapi_layout_free(layout);
+    if (close(fd)) {
+        cerr << "Error closing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return osts;
+}
+
+//------------------------------------------------------------------------------
+// write or read all the stripe units of stripe 'stripe', i.e. all the data
+// stored on a single OST
+IOInfo StripeIO(const char* fname, bool write, int stripe, int stripeCount,
+                uint64_t stripeSize, size_t bytes) {
+    const int fd = open(fname, write ? O_WRONLY : O_RDONLY);
+    if (fd < 0) {
+        cerr << "Error opening file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    char* buffer = static_cast<char*>(aligned_alloc(getpagesize(), stripeSize));
+    if (!buffer) {
+        cerr << "Failed to allocate memory. Error: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    fill(buffer, buffer + stripeSize, char(stripe));
+    const size_t units = bytes / stripeSize;
+    const auto start = Clock::now();
+    for (size_t u = 0; u != units; ++u) {
+        const size_t offset = (u * stripeCount + stripe) * stripeSize;
+        const ssize_t b = write ? pwrite(fd, buffer, stripeSize, offset)
+                                : pread(fd, buffer, stripeSize, offset);
+        if (b != ssize_t(stripeSize)) {
+            cerr << "Error " << (write ? "writing to" : "reading from")
+                 << " file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (write && fsync(fd)) {
+        cerr << "Error syncing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    const auto end = Clock::now();
+    // drop cached pages so that the read phase hits the OSTs
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    free(buffer);
+    if (close(fd)) {
+        cerr << "Error closing file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return {bytes, Elapsed(end - start)};
+}
+
+// one thread per stripe, returns aggregate bandwidth
+float PoolIO(const string& fname, bool write, int stripeCount,
+             uint64_t stripeSize, size_t bytesPerOST, vector<IOInfo>& info) {
+    vector<future<IOInfo>> workers(stripeCount);
+    const auto start = Clock::now();
+    for (int s = 0; s != stripeCount; ++s) {
+        workers[s] = async(launch::async, StripeIO, fname.c_str(), write, s,
+                           stripeCount, stripeSize, bytesPerOST);
+    }
+    for (auto& w : workers) w.wait();
+    const auto end = Clock::now();
+    info.resize(stripeCount);
+    for (int s = 0; s != stripeCount; ++s) info[s] = workers[s].get();
+    return GiBs(Elapsed(end - start), bytesPerOST * stripeCount);
+}
+
+//------------------------------------------------------------------------------
+void PrintResult(const Pool& pool, const PoolResult& r) {
+    cout << "Pool: " << pool.name << " - " << r.osts.size() << " OSTs" << endl;
+    cout << "  Write: " << r.writeBw << " GiB/s" << endl;
+    cout << "  Read:  " << r.readBw << " GiB/s" << endl;
+    for (int i = 0; i != r.osts.size(); ++i) {
+        cout << "  OST " << r.osts[i]
+             << ": write " << GiBs(r.write[i].seconds, r.write[i].bytes)
+             << " GiB/s, read " << GiBs(r.read[i].seconds, r.read[i].bytes)
+             << " GiB/s" << endl;
+    }
+    cout << endl;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    const Config config = ParseCommandLine(argc, argv);
+    vector<Pool> pools = GetPools(config.dir);
+    if (!config.pool.empty()) {
+        pools.erase(remove_if(begin(pools), end(pools),
+                              [&config](const Pool& p) {
+                                  return PoolName(p.name) !=
+                                         PoolName(config.pool);
+                              }),
+                    end(pools));
+    }
+    if (pools.empty()) {
+        cerr << "No pools found" << endl;
+        exit(EXIT_FAILURE);
+    }
+    for (const auto& pool : pools) {
+        if (pool.members.empty()) {
+            cout << "Pool: " << pool.name << " - empty, skipped" << endl
+                 << endl;
+            continue;
+        }
+        const string fname = config.dir + "/pool_test." + PoolName(pool.name) +
+                             "." + to_string(getpid());
+        const int stripeCount = pool.members.size();
+        PoolResult r;
+        r.osts = CreatePoolFile(fname, pool.name, config.stripeSize,
+                                stripeCount);
+        r.writeBw = PoolIO(fname, true, stripeCount, config.stripeSize,
+                           config.bytesPerOST, r.write);
+        r.readBw = PoolIO(fname, false, stripeCount, config.stripeSize,
+                          config.bytesPerOST, r.read);
+        if (!config.keep && unlink(fname.c_str())) {
+            cerr << "Error deleting file " << fname << ": " << strerror(errno)
+                 << endl;
+        }
+        PrintResult(pool, r);
+    }
+    return 0;
+}
@@ -36,35 +36,339 @@
  ******************************************************************************/
 
 //print Lustre file layout
+//single file: print stripe size, count and stripe -> OST map
+//directory tree (-r): walk the tree in parallel and dump the layout of all
+//the regular files in columnar format:
+//  <output>.paths:  <path id> <path>
+//  <output>.layout: <path id> <stripe count> <stripe size> <OST,OST,...>
+//followed by a summary with the stripe count and stripe size histograms.
+//Directories are distributed among threads through per-thread deques: each
+//thread processes its own directories last-in first-out and steals the
+//oldest directories from the other threads when its deque is empty.
 
+#include <dirent.h>
+#include <fcntl.h>
 #include <lustre/lustreapi.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
+#include <atomic>
 #include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
 #include <iostream>
+#include <lyra/lyra.hpp>
+#include <map>
+#include <mutex>
+#include <string>
 #include <vector>
 
 using namespace std;
 
-int main(int argc, char* argv[]) {
-    if(argc != 2) {
-        cerr << "Usage: " << argv[0] << " <file name>" << endl;
+// Configuration information read from command line
+struct Config {
+    string path;
+    bool recursive = false;
+    int numThreads = thread::hardware_concurrency();
+    string output = "layout";  // output file prefix, recursive mode only
+};
+
+// per-thread counters and histograms
+struct WalkInfo {
+    size_t files = 0;
+    size_t errors = 0;
+    map<uint64_t, size_t> stripeCount;  // stripe count -> number of files
+    map<uint64_t, size_t> stripeSize;   // stripe size -> number of files
+};
+
+// directory queue with stealing
+struct WorkQueue {
+    mutex m;
+    deque<string> dirs;
+};
+
+// state shared by all threads
+struct Walk {
+    vector<WorkQueue> queues;
+    atomic<size_t> pendingDirs{0};  // queued or being processed
+    atomic<size_t> queuedDirs{0};   // queued only
+    // idle workers wait for a directory to be queued or the walk to end
+    mutex idleMutex;
+    condition_variable idle;
+    atomic<size_t> pathId{0};
+    mutex outMutex;
+    ofstream paths;
+    ofstream layouts;
+    explicit Walk(int n) : queues(n) {}
+};
+
+//------------------------------------------------------------------------------
+Config ParseCommandLine(int argc, char** argv) {
+    static const char* HELP_TEXT = R"(
+        Print layout of file or, with -r, dump the layout of all the
+        files in a directory tree to <output>.paths and <output>.layout
+        and print stripe count and size histograms. E.g.
+        >print_layout_info /scratch/project -r -t 32 -o project_layout
+    )";
+    Config cfg;
+    bool showHelp = false;
+    auto cli =
+        lyra::help(showHelp).description(HELP_TEXT) |
+        lyra::arg(cfg.path, "path")("File or directory").required() |
+        lyra::opt(cfg.recursive)["-r"]["--recursive"](
+            "Walk directory tree")
+            .optional() |
+        lyra::opt(cfg.numThreads, "num threads")["-t"]["--threads"](
+            "Number of threads, recursive mode only")
+            .optional() |
+        lyra::opt(cfg.output, "output")["-o"]["--output"](
+            "Output file prefix, recursive mode only")
+            .optional();
+
+    auto result = cli.parse({argc, argv});
+    if (!result) {
+        cerr << result.errorMessage() << endl;
+        cerr << cli << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (showHelp) {
+        cout << cli;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.numThreads < 1) {
+        cerr << "Invalid number of threads" << endl;
+        exit(EXIT_FAILURE);
+    }
+    return cfg;
+}
+
+//------------------------------------------------------------------------------
+void PrintLayout(const char* path) {
+    llapi_layout* layout = llapi_layout_get_by_path(path, 0);
+    if (!layout) {
+        cerr << "Error retrieving layout information: " << strerror(errno)
+             << endl;
         exit(EXIT_FAILURE);
     }
-    llapi_layout* layout = llapi_layout_get_by_path(argv[1], 0);
     // get layout attributes
     uint64_t size = 0;
-    llapi_layout_stripe_size_get(layout, &size);
     uint64_t count = 0;
-    llapi_layout_stripe_count_get(layout, &count);
+    if (llapi_layout_stripe_size_get(layout, &size) ||
+        llapi_layout_stripe_count_get(layout, &count)) {
+        cerr << "Error retrieving layout attributes: " << strerror(errno)
+             << endl;
+        exit(EXIT_FAILURE);
+    }
     // print
     cout << "Stripe size: " << size << endl;
     cout << "Stripe count: " << count << endl;
     uint64_t ostIndex = uint64_t(-1);
     for (int i = 0; i != count; ++i) {
-        llapi_layout_ost_index_get(layout, i, &ostIndex);
+        if (llapi_layout_ost_index_get(layout, i, &ostIndex)) {
+            cerr << "Error retrieving OST index: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
         cout << "Stripe " << i << ": OST " << ostIndex << endl;
     }
     llapi_layout_free(layout);
+}
+
+//------------------------------------------------------------------------------
+// retrieve layout of file 'name' in directory 'dirfd' and append it to
+// output buffers, returns false on error
+bool FileLayout(int dirfd, const char* name, size_t id, string& layoutOut,
+                WalkInfo& info) {
+    const int fd =
+        openat(dirfd, name, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_NOCTTY);
+    if (fd < 0) return false;
+    llapi_layout* layout = llapi_layout_get_by_fd(fd, 0);
+    close(fd);
+    if (!layout) return false;
+    uint64_t size = 0;
+    uint64_t count = 0;
+    bool ok = !llapi_layout_stripe_size_get(layout, &size) &&
+              !llapi_layout_stripe_count_get(layout, &count);
+    string osts;
+    for (uint64_t i = 0; ok && i != count; ++i) {
+        uint64_t ost = 0;
+        ok = !llapi_layout_ost_index_get(layout, i, &ost);
+        if (i) osts += ',';
+        osts += to_string(ost);
+    }
+    llapi_layout_free(layout);
+    if (!ok) return false;
+    layoutOut += to_string(id) + ' ' + to_string(count) + ' ' +
+                 to_string(size) + ' ' + osts + '\n';
+    ++info.stripeCount[count];
+    ++info.stripeSize[size];
+    return true;
+}
+
+// append buffered output to files when larger than threshold
+void Flush(Walk& walk, string& pathOut, string& layoutOut,
+           size_t threshold = 1 << 20) {
+    if (pathOut.size() + layoutOut.size() < threshold) return;
+    lock_guard<mutex> lock(walk.outMutex);
+    walk.paths << pathOut;
+    walk.layouts << layoutOut;
+    pathOut.clear();
+    layoutOut.clear();
+}
+
+// process one directory: files are handled in place, subdirectories are
+// pushed into the thread's own queue
+void ProcessDir(Walk& walk, int self, const string& dir, string& pathOut,
+                string& layoutOut, WalkInfo& info) {
+    const int dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    DIR* d = dirfd < 0 ? nullptr : fdopendir(dirfd);
+    if (!d) {
+        if (dirfd >= 0) close(dirfd);
+        ++info.errors;
+        return;
+    }
+    while (dirent* e = readdir(d)) {
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, "..")) continue;
+        unsigned char type = e->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (fstatat(dirfd, e->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+                ++info.errors;
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR
+                                       : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        }
+        const string path = dir + '/' + e->d_name;
+        if (type == DT_DIR) {
+            ++walk.pendingDirs;
+            {
+                lock_guard<mutex> lock(walk.queues[self].m);
+                walk.queues[self].dirs.push_back(path);
+                ++walk.queuedDirs;
+            }
+            lock_guard<mutex> lock(walk.idleMutex);
+            walk.idle.notify_one();
+        } else if (type == DT_REG) {
+            const size_t id = walk.pathId++;
+            if (FileLayout(dirfd, e->d_name, id, layoutOut, info)) {
+                ++info.files;
+            } else {
+                ++info.errors;
+            }
+            pathOut += to_string(id) + ' ' + path + '\n';
+            Flush(walk, pathOut, layoutOut);
+        }
+    }
+    closedir(d);
+}
+
+// pop newest directory from own queue or steal oldest from other queues
+bool NextDir(Walk& walk, int self, string& dir) {
+    {
+        WorkQueue& q = walk.queues[self];
+        lock_guard<mutex> lock(q.m);
+        if (!q.dirs.empty()) {
+            dir = move(q.dirs.back());
+            q.dirs.pop_back();
+            --walk.queuedDirs;
+            return true;
+        }
+    }
+    const int n = walk.queues.size();
+    for (int i = 1; i != n; ++i) {
+        WorkQueue& q = walk.queues[(self + i) % n];
+        lock_guard<mutex> lock(q.m);
+        if (!q.dirs.empty()) {
+            dir = move(q.dirs.front());
+            q.dirs.pop_front();
+            --walk.queuedDirs;
+            return true;
+        }
+    }
+    return false;
+}
+
+WalkInfo Worker(Walk& walk, int self) {
+    WalkInfo info;
+    string pathOut;
+    string layoutOut;
+    string dir;
+    while (true) {
+        if (NextDir(walk, self, dir)) {
+            ProcessDir(walk, self, dir, pathOut, layoutOut, info);
+            if (--walk.pendingDirs == 0) {
+                lock_guard<mutex> lock(walk.idleMutex);
+                walk.idle.notify_all();
+            }
+            continue;
+        }
+        unique_lock<mutex> lock(walk.idleMutex);
+        walk.idle.wait(lock, [&walk] {
+            return walk.pendingDirs == 0 || walk.queuedDirs > 0;
+        });
+        if (walk.pendingDirs == 0) break;
+    }
+    Flush(walk, pathOut, layoutOut, 0);
+    return info;
+}
 
+//------------------------------------------------------------------------------
+void PrintHistogram(const char* title, const map<uint64_t, size_t>& h) {
+    cout << title << endl;
+    for (const auto& kv : h) {
+        cout << "  " << kv.first << ": " << kv.second << endl;
+    }
+}
+
+void WalkTree(const Config& config) {
+    Walk walk(config.numThreads);
+    walk.paths.open(config.output + ".paths");
+    walk.layouts.open(config.output + ".layout");
+    if (!walk.paths || !walk.layouts) {
+        cerr << "Cannot open output files " << config.output << ".*" << endl;
+        exit(EXIT_FAILURE);
+    }
+    walk.queues[0].dirs.push_back(config.path);
+    walk.pendingDirs = 1;
+    walk.queuedDirs = 1;
+    const auto start = chrono::steady_clock::now();
+    vector<future<WalkInfo>> workers(config.numThreads);
+    for (int t = 0; t != config.numThreads; ++t) {
+        workers[t] = async(launch::async, Worker, ref(walk), t);
+    }
+    WalkInfo total;
+    for (auto& w : workers) {
+        const WalkInfo info = w.get();
+        total.files += info.files;
+        total.errors += info.errors;
+        for (const auto& kv : info.stripeCount)
+            total.stripeCount[kv.first] += kv.second;
+        for (const auto& kv : info.stripeSize)
+            total.stripeSize[kv.first] += kv.second;
+    }
+    const auto end = chrono::steady_clock::now();
+    const double seconds = chrono::duration<double>(end - start).count();
+    cout << "Files:   " << total.files << endl;
+    cout << "Errors:  " << total.errors << endl;
+    cout << "Time:    " << seconds << " s" << endl;
+    cout << "Files/s: " << (seconds > 0 ? total.files / seconds : 0) << endl;
+    PrintHistogram("Stripe count histogram (stripe count: files)",
+                   total.stripeCount);
+    PrintHistogram("Stripe size histogram (stripe size: files)",
+                   total.stripeSize);
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    const Config config = ParseCommandLine(argc, argv);
+    if (config.recursive) {
+        WalkTree(config);
+    } else {
+        PrintLayout(config.path.c_str());
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,397 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+
+// Start barrier for multi-process runs launched with srun, no MPI required.
+// Processes on the same node meet in a shared memory segment (/dev/shm), the
+// first process on each node (SLURM local id 0) then meets the other nodes
+// through files created in a directory on the shared filesystem. Once all
+// nodes have arrived the node 0 leader publishes a release time slightly in
+// the future (realtime clock) and every process sleeps until that time, so
+// the timed phase starts together on all nodes within clock synchronisation
+// accuracy (NTP/PTP), not within the filesystem polling interval.
+// At the end of the timed phase each process records node id, start and end
+// time and bytes transferred; process 0 collects the records and reports the
+// aggregate bandwidth, total bytes / (last end - first start), which unlike
+// the sum of per-process bandwidths is not inflated when processes do not
+// overlap, together with per-node totals and straggler processes.
+// Without the per-node task count (SLURM_STEP_TASKS_PER_NODE) every process
+// meets the others through the shared filesystem.
+//
+// Files in the barrier directory:
+//   arrive.<rank>  node leader arrived
+//   release        release time, ns since epoch
+//   done.<rank>    <node id> <start ns> <end ns> <bytes>
+//   <name>.<rank>  records collected with Gather
+
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+// timed phase of one process
+struct RankResult {
+    int rank = 0;
+    int node = 0;
+    int64_t startNs = 0;  // realtime clock
+    int64_t endNs = 0;
+    size_t bytes = 0;
+    double Elapsed() const { return (endNs - startNs) / 1E9; }
+};
+
+// processes slower than factor x median elapsed time are stragglers
+const double STRAGGLER_FACTOR = 1.25;
+
+// CSV report:
+//   aggregate,<processes>,<GiB/s>,<elapsed (s)>,<start skew (s)>
+//   node,<node id>,<processes>,<bytes>,<GiB/s>,<elapsed (s)>
+//   straggler,<rank>,<node id>,<elapsed (s)>,<elapsed / median elapsed>
+// node bandwidth is computed over the node's [first start, last end]
+inline void PrintRankResults(const std::vector<RankResult>& results) {
+    if (results.empty()) return;
+    const double GiB = 1 << 30;
+    struct Totals {
+        int processes = 0;
+        size_t bytes = 0;
+        int64_t firstStart = INT64_MAX;
+        int64_t lastStart = 0;
+        int64_t lastEnd = 0;
+        void Add(const RankResult& r) {
+            ++processes;
+            bytes += r.bytes;
+            firstStart = std::min(firstStart, r.startNs);
+            lastStart = std::max(lastStart, r.startNs);
+            lastEnd = std::max(lastEnd, r.endNs);
+        }
+        double Elapsed() const { return (lastEnd - firstStart) / 1E9; }
+    };
+    Totals all;
+    std::map<int, Totals> nodes;
+    std::vector<double> elapsed;
+    for (const auto& r : results) {
+        all.Add(r);
+        nodes[r.node].Add(r);
+        elapsed.push_back(r.Elapsed());
+    }
+    std::cout << "aggregate," << all.processes << ","
+              << all.bytes / GiB / all.Elapsed() << "," << all.Elapsed()
+              << "," << (all.lastStart - all.firstStart) / 1E9 << std::endl;
+    for (const auto& kv : nodes) {
+        const Totals& t = kv.second;
+        std::cout << "node," << kv.first << "," << t.processes << ","
+                  << t.bytes << "," << t.bytes / GiB / t.Elapsed() << ","
+                  << t.Elapsed() << std::endl;
+    }
+    std::nth_element(elapsed.begin(), elapsed.begin() + elapsed.size() / 2,
+                     elapsed.end());
+    const double median = elapsed[elapsed.size() / 2];
+    for (const auto& r : results) {
+        if (median > 0 && r.Elapsed() > STRAGGLER_FACTOR * median) {
+            std::cout << "straggler," << r.rank << "," << r.node << ","
+                      << r.Elapsed() << "," << r.Elapsed() / median
+                      << std::endl;
+        }
+    }
+}
+
+// node-local barrier state
+struct RankBarrierShm {
+    std::atomic<int> arrived;         // local processes other than leader
+    std::atomic<int64_t> releaseNs;  // 0 until released
+};
+
+class RankBarrier {
+   public:
+    // 'dir' must be on a filesystem shared by all the nodes
+    explicit RankBarrier(const std::string& dir) : dir_(dir) {
+        rank_ = EnvInt("SLURM_PROCID", 0);
+        numRanks_ = EnvInt("SLURM_NTASKS", 1);
+        nodeId_ = EnvInt("SLURM_NODEID", 0);
+        const char* tpn = getenv("SLURM_STEP_TASKS_PER_NODE");
+        if (tpn) localTasks_ = TasksOnNode(tpn, nodeId_, numNodes_);
+        if (localTasks_ > 0) {
+            leader_ = EnvInt("SLURM_LOCALID", 0) == 0;
+            coordinator_ = leader_ && nodeId_ == 0;
+        } else {
+            // one participant per process
+            localTasks_ = 1;
+            numNodes_ = numRanks_;
+            coordinator_ = rank_ == 0;
+        }
+    }
+    ~RankBarrier() {
+        if (shm_) munmap(shm_, sizeof(RankBarrierShm));
+    }
+    // wait for all processes, returns at the common release time
+    void Wait() {
+        if (numRanks_ < 2) {
+            releaseNs_ = startNs_ = Now();
+            return;
+        }
+        if (mkdir(dir_.c_str(), 0755) && errno != EEXIST) {
+            Fail("cannot create barrier directory " + dir_);
+        }
+        if (localTasks_ > 1) OpenShm();
+        if (leader_) {
+            if (localTasks_ > 1) {
+                // all local processes have the segment mapped at this point
+                Poll([this] { return shm_->arrived == localTasks_ - 1; });
+                unlink(shmPath_.c_str());
+            }
+            Touch(dir_ + "/arrive." + std::to_string(rank_));
+            if (coordinator_) {
+                Poll([this] { return Count("arrive.") == numNodes_; });
+                WriteFile("release", std::to_string(Now() + RELEASE_DELAY_NS));
+            }
+            std::string release;
+            Poll([this, &release] { return ReadFile("release", release); });
+            releaseNs_ = std::stoll(release);
+            if (localTasks_ > 1) shm_->releaseNs = releaseNs_;
+        } else {
+            shm_->arrived += 1;
+            Poll([this] { return shm_->releaseNs != 0; }, true);
+            releaseNs_ = shm_->releaseNs;
+        }
+        const int64_t wait = releaseNs_ - Now();
+        if (wait > 0) {
+            std::this_thread::sleep_for(std::chrono::nanoseconds(wait));
+        }
+        startNs_ = Now();
+    }
+    // delay between release and start of this process, seconds
+    double StartDelay() const { return (startNs_ - releaseNs_) / 1E9; }
+    // release and start time, realtime ns since epoch
+    int64_t ReleaseNs() const { return releaseNs_; }
+    int64_t StartNs() const { return startNs_; }
+    // collect one record per process on process 0, to be called by all the
+    // processes between Wait and Done; returns the records in rank order on
+    // process 0, nothing on the others
+    std::vector<std::string> Gather(const std::string& name,
+                                    const std::string& data) {
+        if (numRanks_ < 2) return {data};
+        WriteFile(name + "." + std::to_string(rank_), data);
+        if (rank_ != 0) return {};
+        Poll([this, &name] { return Count(name + ".") == numRanks_; });
+        std::vector<std::string> records(numRanks_);
+        for (int r = 0; r != numRanks_; ++r) {
+            std::ifstream is(dir_ + "/" + name + "." + std::to_string(r));
+            records[r].assign(std::istreambuf_iterator<char>(is),
+                              std::istreambuf_iterator<char>());
+        }
+        return records;
+    }
+    // record end of timed phase; process 0 waits for all the processes and
+    // prints the results, see PrintRankResults; 'endNs' defaults to now
+    void Done(size_t bytes, int64_t endNs = 0) {
+        if (numRanks_ < 2) return;
+        WriteFile("done." + std::to_string(rank_),
+                  std::to_string(nodeId_) + " " + std::to_string(startNs_) +
+                      " " + std::to_string(endNs ? endNs : Now()) + " " +
+                      std::to_string(bytes));
+        if (rank_ != 0) return;
+        Poll([this] { return Count("done.") == numRanks_; });
+        std::vector<RankResult> results(numRanks_);
+        for (int r = 0; r != numRanks_; ++r) {
+            std::ifstream is(dir_ + "/done." + std::to_string(r));
+            RankResult& rr = results[r];
+            rr.rank = r;
+            if (!(is >> rr.node >> rr.startNs >> rr.endNs >> rr.bytes)) {
+                Fail("invalid done file");
+            }
+        }
+        PrintRankResults(results);
+        RemoveDir();
+    }
+
+    // realtime ns since epoch, same scale as ReleaseNs and Done's 'endNs'
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+
+   private:
+    static const int64_t RELEASE_DELAY_NS = 100000000;  // 100 ms
+    static const int TIMEOUT_S = 600;
+    static int EnvInt(const char* name, int def) {
+        const char* v = getenv(name);
+        return v ? int(strtol(v, NULL, 10)) : def;
+    }
+    static void Fail(const std::string& msg) {
+        std::cerr << "Barrier error: " << msg << " " << strerror(errno)
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    // number of tasks on node 'nodeId' from "2(x3),1" (2 tasks on nodes
+    // 0-2, 1 task on node 3), also returns the number of nodes; -1 if the
+    // node is not listed
+    static int TasksOnNode(const std::string& s, int nodeId, int& numNodes) {
+        int tasks = -1;
+        numNodes = 0;
+        for (size_t p = 0; p < s.size();) {
+            const size_t end = std::min(s.find(',', p), s.size());
+            const std::string item = s.substr(p, end - p);
+            const int n = std::atoi(item.c_str());
+            const size_t x = item.find("(x");
+            const int repeat = x == std::string::npos
+                                   ? 1
+                                   : std::atoi(item.c_str() + x + 2);
+            if (nodeId >= numNodes && nodeId < numNodes + repeat) tasks = n;
+            numNodes += repeat;
+            p = end + 1;
+        }
+        return tasks;
+    }
+    // poll with exponential backoff up to 10 ms, 'local' polls shared
+    // memory only
+    template <typename F>
+    void Poll(F done, bool local = false) {
+        using Clock = std::chrono::steady_clock;
+        const auto start = Clock::now();
+        auto wait = std::chrono::microseconds(local ? 50 : 1000);
+        while (!done()) {
+            if (Clock::now() - start > std::chrono::seconds(TIMEOUT_S)) {
+                Fail("timeout waiting for other processes");
+            }
+            std::this_thread::sleep_for(wait);
+            wait = std::min(2 * wait, std::chrono::microseconds(10000));
+        }
+    }
+    void OpenShm() {
+        const char* job = getenv("SLURM_JOB_ID");
+        const char* step = getenv("SLURM_STEP_ID");
+        const char* node = getenv("SLURM_NODEID");
+        shmPath_ = std::string("/dev/shm/rank_barrier.") + (job ? job : "0") +
+                   "." + (step ? step : "0") + "." + (node ? node : "0");
+        const int fd = open(shmPath_.c_str(), O_RDWR | O_CREAT, 0600);
+        // new pages are zero filled: no initialisation required
+        if (fd < 0 || ftruncate(fd, sizeof(RankBarrierShm))) {
+            Fail("cannot create " + shmPath_);
+        }
+        void* p = mmap(NULL, sizeof(RankBarrierShm), PROT_READ | PROT_WRITE,
+                       MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) Fail("cannot map " + shmPath_);
+        shm_ = static_cast<RankBarrierShm*>(p);
+    }
+    void Touch(const std::string& path) {
+        const int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+        if (fd < 0) Fail("cannot create " + path);
+        close(fd);
+    }
+    // write then rename: readers never see partial content
+    void WriteFile(const std::string& name, const std::string& content) {
+        const std::string path = dir_ + "/" + name;
+        {
+            std::ofstream os(path + ".tmp");
+            os << content;
+            if (!os) Fail("cannot write " + path);
+        }
+        if (rename((path + ".tmp").c_str(), path.c_str())) {
+            Fail("cannot rename " + path);
+        }
+    }
+    bool ReadFile(const std::string& name, std::string& content) {
+        std::ifstream is(dir_ + "/" + name);
+        return bool(is >> content);
+    }
+    int Count(const std::string& prefix) {
+        DIR* d = opendir(dir_.c_str());
+        if (!d) Fail("cannot open " + dir_);
+        int n = 0;
+        while (dirent* e = readdir(d)) {
+            const std::string name = e->d_name;
+            if (name.compare(0, prefix.size(), prefix) == 0 &&
+                name.find(".tmp") == std::string::npos)
+                ++n;
+        }
+        closedir(d);
+        return n;
+    }
+    void RemoveDir() {
+        DIR* d = opendir(dir_.c_str());
+        if (!d) return;
+        while (dirent* e = readdir(d)) {
+            const std::string name = e->d_name;
+            if (name != "." && name != "..") {
+                unlink((dir_ + "/" + name).c_str());
+            }
+        }
+        closedir(d);
+        rmdir(dir_.c_str());
+    }
+    std::string dir_;
+    std::string shmPath_;
+    RankBarrierShm* shm_ = nullptr;
+    int rank_ = 0;
+    int numRanks_ = 1;
+    int nodeId_ = 0;
+    int numNodes_ = 1;
+    int localTasks_ = -1;
+    bool leader_ = true;
+    bool coordinator_ = false;
+    int64_t releaseNs_ = 0;
+    int64_t startNs_ = 0;
+};
+
+// default barrier directory: RANK_BARRIER_DIR or next to the test file,
+// unique per job step
+inline std::string RankBarrierDir(const std::string& fname) {
+    const char* dir = getenv("RANK_BARRIER_DIR");
+    const char* job = getenv("SLURM_JOB_ID");
+    const char* step = getenv("SLURM_STEP_ID");
+    return (dir ? std::string(dir) + "/rank_barrier" : fname + ".barrier") +
+           "." + (job ? job : "0") + "." + (step ? step : "0");
+}
@@ -57,8 +57,17 @@
 #include <lyra/lyra.hpp>
 #include <map>
 #include <numeric>
+#include <random>
+#include <sstream>
 #include <vector>
 
+#include "extent_map.h"
+#include "fd_mode.h"
+#include "layout_cache.h"
+#include "rank_barrier.h"
+#include "stats.h"
+#include "stonewall.h"
+
 using namespace std;
 
 // constants
@@ -70,10 +79,48 @@ constexpr float us = 1E6;
 //            MemoryMapped --> mmap / munmap
 enum class ReadMode { Buffered, Unbuffered, MemoryMapped };
 
+// time (s) spent in each phase of a read: open (and mmap), first
+// FIRST_BYTE_SIZE bytes, rest of the data, close (and munmap); first byte
+// time is only measured when phases are timed, otherwise it is included in
+// the transfer time
+struct Phases {
+    float open = 0.f;
+    float firstByte = 0.f;
+    float transfer = 0.f;
+    float close = 0.f;
+};
+
+// size of the first read when timing phases
+const size_t FIRST_BYTE_SIZE = 4096;
+
+// readahead control, unbuffered reads only:
+//   default:    kernel (llite) readahead
+//   sequential: POSIX_FADV_SEQUENTIAL
+//   random:     POSIX_FADV_RANDOM, readahead disabled
+//   noreuse:    POSIX_FADV_NOREUSE
+//   explicit:   readahead disabled, readahead() issued 'window' bytes ahead
+//               of the transfers in the order they are read
+enum class Readahead { Default, Sequential, Random, NoReuse, Explicit };
+const char* READAHEAD_NAMES[] = {"default", "sequential", "random", "noreuse",
+                                 "explicit"};
+
+// access pattern, unbuffered reads only
+struct Access {
+    size_t transferSize = 0;  // bytes per read, 0: whole part, <= 1 GiB reads
+    bool random = false;      // transfers in random order within each part
+    Readahead readahead = Readahead::Default;
+    size_t window = 4 << 20;  // explicit readahead window
+};
+
 // read performance
 struct ReadInfo {
     size_t readBytes = 0;
     float bandwidth = 0.f;
+    size_t offset = 0;  // file offset
+    float seconds = 0.f;
+    Phases phases;
+    vector<float> callLatency;  // per read call, when phases are timed
+    StonewallResult wall;       // unbuffered reads only
 };
 
 // Compute elapsed time
@@ -90,84 +137,181 @@ constexpr float GiBs(float seconds, size_t numBytes) {
 
 // Configuration information read from command line
 struct Config {
+    string fileName;
     int numThreads = 0;
     ReadMode readMode = ReadMode::Unbuffered;
     size_t partFraction = 1;  // read 1/stripeFraction bytes from each stripe
     bool bwOnly = false;      // if true only print raw bandwidth number
     bool perOSTBw = false;
+    bool timePhases = false;  // per-phase latency percentiles
+    FdMode fdMode = FdMode::Thread;
+    Access access;
+    string layoutCache;  // layout cache file, empty: query MDS
+    string stonewall;    // <seconds>s or <bytes>, see stonewall.h
+    bool finish = false;  // complete the part after the stonewall
 };
 
 // default clock
 using Clock = chrono::high_resolution_clock;
 
-// standard deviation
-template <typename SeqT>
-typename SeqT::value_type StandardDeviation(const SeqT& seq) {
-    using Value = typename SeqT::value_type;
-    const typename SeqT::size_type N = seq.size();
-    const Value sum =
-        std::accumulate(std::cbegin(seq), std::cend(seq), Value(0));
-    const Value avg = sum / N;
-    SeqT s;
-    std::transform(std::cbegin(seq), std::cend(seq), std::back_inserter(s),
-                   [avg, N](Value v) { return (v - avg) * (v - avg) / N; });
-    const Value variance =
-        std::accumulate(std::cbegin(s), std::cend(s), Value(0));
-    return std::sqrt(variance);
-}
-
-// median
-template <typename SeqT>
-typename SeqT::value_type Median(SeqT seq) {
-    nth_element(begin(seq), begin(seq) + seq.size() / 2, end(seq));
-    return seq[seq.size() / 2];
-}
-
 //------------------------------------------------------------------------------
-// read file part, using file descriptor (unbuffered read)
-ReadInfo ReadPartFd(const char* fname, char* dest, size_t size, size_t offset) {
-    const int flags = O_RDONLY | O_LARGEFILE;
-    const int mode = S_IRUSR;  // | S_IWUSR | S_IRGRP | S_IROTH;
-    const int fd = open(fname, flags, mode);
-    if (fd < 0) {
-        cerr << "File creation has failed, error: " << strerror(errno);
+// apply readahead advice to the range read by a thread
+void Advise(int fd, size_t offset, size_t size, Readahead readahead) {
+    int advice = 0;
+    switch (readahead) {
+        case Readahead::Sequential:
+            advice = POSIX_FADV_SEQUENTIAL;
+            break;
+        case Readahead::Random:
+        case Readahead::Explicit:
+            advice = POSIX_FADV_RANDOM;
+            break;
+        case Readahead::NoReuse:
+            advice = POSIX_FADV_NOREUSE;
+            break;
+        default:
+            return;
+    }
+    const int err = posix_fadvise(fd, offset, size, advice);
+    if (err) {
+        cerr << "Error (posix_fadvise): " << strerror(err) << endl;
         exit(EXIT_FAILURE);
     }
+}
+
+// read file part, using file descriptor (unbuffered read); 'fd' is the
+// descriptor opened by the caller in preopen and shared mode; the stonewall
+// is checked before each transfer
+ReadInfo ReadPartFd(const char* fname, char* dest, size_t size, size_t offset,
+                    bool timePhases, FdMode fdMode, int fd,
+                    const Access& access, Stonewall& stonewall) {
+    Phases phases;
+    auto openFile = [fname, &phases]() {
+        const auto t = Clock::now();
+        const int flags = O_RDONLY | O_LARGEFILE;
+        const int mode = S_IRUSR;  // | S_IWUSR | S_IRGRP | S_IROTH;
+        const int fd = open(fname, flags, mode);
+        if (fd < 0) {
+            cerr << "File creation has failed, error: " << strerror(errno);
+            exit(EXIT_FAILURE);
+        }
+        phases.open += Elapsed(Clock::now() - t);
+        return fd;
+    };
+    auto closeFile = [&phases](int fd) {
+        const auto t = Clock::now();
+        if (close(fd)) {
+            cerr << "Error closing file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        phases.close += Elapsed(Clock::now() - t);
+    };
+    const bool perTransfer = fdMode == FdMode::Transfer;
+    if (fdMode == FdMode::Thread) fd = openFile();
+    if (!perTransfer) Advise(fd, offset, size, access.readahead);
+    // transfers: {offset in part, size}, the first byte read is always first
     // problems when size > 2 GB
     const size_t maxChunkSize = 1 << 30;  // read in chunks of 1GB max
-    const size_t chunks = size / maxChunkSize;
-    const size_t remainder = size % maxChunkSize;
-    size_t bytesRead = 0;
+    const size_t chunkSize =
+        access.transferSize ? min(access.transferSize, maxChunkSize)
+                            : maxChunkSize;
+    vector<pair<size_t, size_t>> transfers;
     size_t off = 0;
+    if (timePhases && size) {
+        transfers.push_back({0, min(size, FIRST_BYTE_SIZE)});
+        off = transfers.back().second;
+    }
+    for (; off < size; off += chunkSize) {
+        transfers.push_back({off, min(chunkSize, size - off)});
+    }
+    if (access.random) {
+        shuffle(transfers.begin() + (timePhases ? 1 : 0), transfers.end(),
+                mt19937_64(offset));
+    }
+    vector<float> latency;
+    if (timePhases) latency.reserve(transfers.size());
+    size_t bytesRead = 0;
+    size_t requested = 0;  // bytes of the transfers started so far
+    size_t ahead = 0;      // next transfer to read ahead
+    size_t aheadBytes = 0;
+    StonewallResult wall;
+    bool hit = false;
     auto start = chrono::high_resolution_clock::now();
-    for (int i = 0; i < chunks; ++i) {
-        off = maxChunkSize * i;
-        const ssize_t rb = pread(fd, dest + off, maxChunkSize, offset + off);
-        if (rb == -1) {
-            cerr << "Error reading file (pread): " << strerror(errno) << endl;
-            exit(EXIT_FAILURE);
+    for (size_t i = 0; i != transfers.size(); ++i) {
+        if (!hit && stonewall.Enabled() && stonewall.Hit()) {
+            hit = true;
+            wall.wallBytes = bytesRead;
+            wall.wallNs = Stonewall::Now();
+            if (!stonewall.Finish()) break;
         }
-        bytesRead += rb;
-    }
-    if (remainder) {
-        const ssize_t rb = pread(fd, dest + off, remainder, offset + off);
-        if (rb == -1) {
-            cerr << "Error reading file (pread): " << strerror(errno) << endl;
-            exit(EXIT_FAILURE);
+        const size_t o = transfers[i].first;
+        const size_t sz = transfers[i].second;
+        const int f = perTransfer ? openFile() : fd;
+        if (perTransfer) Advise(f, offset + o, sz, access.readahead);
+        requested += sz;
+        if (access.readahead == Readahead::Explicit) {
+            // keep 'window' bytes of readahead in flight
+            for (; ahead < transfers.size() &&
+                   aheadBytes < requested + access.window;
+                 ++ahead) {
+                const auto& ra = transfers[ahead];
+                if (ahead > i &&
+                    readahead(f, offset + ra.first, ra.second) < 0) {
+                    cerr << "Error (readahead): " << strerror(errno) << endl;
+                    exit(EXIT_FAILURE);
+                }
+                aheadBytes += ra.second;
+            }
         }
-        bytesRead += rb;
+        // pread can return less than requested: loop until the transfer
+        // is complete or the end of file is reached
+        size_t transferred = 0;
+        bool eof = false;
+        while (transferred < sz) {
+            const auto t = Clock::now();
+            const size_t pos = o + transferred;
+            const ssize_t rb =
+                pread(f, dest + pos, sz - transferred, offset + pos);
+            if (rb == -1) {
+                if (errno == EINTR) continue;
+                cerr << "Error reading file (pread): " << strerror(errno)
+                     << endl;
+                exit(EXIT_FAILURE);
+            }
+            const float e = Elapsed(Clock::now() - t);
+            (timePhases && i == 0 ? phases.firstByte : phases.transfer) += e;
+            if (timePhases) latency.push_back(e);
+            if (rb == 0) {
+                eof = true;
+                break;
+            }
+            transferred += rb;
+        }
+        if (perTransfer) closeFile(f);
+        bytesRead += transferred;
+        if (!hit) stonewall.Add(transferred);
+        if (eof) break;
     }
     auto end = chrono::high_resolution_clock::now();
-    if (close(fd)) {
-        cerr << "Error closing file: " << strerror(errno) << endl;
-        exit(EXIT_FAILURE);
-    }
-    return {bytesRead, GiBs(Elapsed(end - start), size)};
+    wall.bytes = bytesRead;
+    wall.endNs = Stonewall::Now();
+    if (!hit) {
+        wall.wallBytes = bytesRead;
+        wall.wallNs = wall.endNs;
+    }
+    if (fdMode == FdMode::Thread) closeFile(fd);
+    ReadInfo ri{bytesRead, GiBs(Elapsed(end - start), size), offset,
+                Elapsed(end - start), phases};
+    ri.callLatency = move(latency);
+    ri.wall = wall;
+    return ri;
 }
 
 // read file part from memory mapped file
-ReadInfo ReadPartMem(const char* fname, char* dest, size_t size,
-                     size_t offset) {
+ReadInfo ReadPartMem(const char* fname, char* dest, size_t size, size_t offset,
+                     bool timePhases) {
+    Phases phases;
+    auto t = Clock::now();
     int fd = open(fname, O_RDONLY | O_LARGEFILE);
     if (fd < 0) {
         cerr << "Error cannot open input file: " << strerror(errno) << endl;
@@ -179,10 +323,19 @@ ReadInfo ReadPartMem(const char* fname, char* dest, size_t size,
         cerr << "Error mmap: " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
+    phases.open = Elapsed(Clock::now() - t);
     auto start = chrono::high_resolution_clock::now();
-    copy(src, src + size,
-         dest);  // note: it invokes __mempcy_avx_unaligned!
+    size_t first = 0;
+    if (timePhases) {
+        first = min(size, FIRST_BYTE_SIZE);
+        copy(src, src + first, dest);
+        phases.firstByte = Elapsed(Clock::now() - start);
+    }
+    t = Clock::now();
+    copy(src + first, src + size,
+         dest + first);  // note: it invokes __mempcy_avx_unaligned!
     auto end = chrono::high_resolution_clock::now();
+    phases.transfer = Elapsed(end - t);
     if (munmap(src, sz)) {
         cerr << "Error unmapping memory: " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
@@ -191,43 +344,69 @@ ReadInfo ReadPartMem(const char* fname, char* dest, size_t size,
         cerr << "Error closing file: " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
-    return {size, GiBs(Elapsed(end - start), size)};
+    phases.close = Elapsed(Clock::now() - end);
+    return {size, GiBs(Elapsed(end - start), size), offset,
+            Elapsed(end - start), phases};
 }
 
-// read file part using standard buffered operations
+// read file part using standard buffered operations; 'f' is the FILE*
+// opened by the caller in preopen and shared mode
 ReadInfo ReadPartFile(const char* fname, char* dest, size_t size,
-                      size_t offset) {
-    FILE* f = fopen(fname, "rb");
-    if (!f) {
-        cerr << "Error opening file: " << strerror(errno) << endl;
-        exit(EXIT_FAILURE);
-    }
-    if (fseek(f, offset, SEEK_SET)) {
-        cerr << "Error moving file pointer (fseek): " << strerror(errno)
-             << endl;
-        exit(EXIT_FAILURE);
-    }
+                      size_t offset, bool timePhases, FdMode fdMode, FILE* f) {
+    Phases phases;
+    auto openFile = [fname, &phases]() {
+        const auto t = Clock::now();
+        FILE* f = fopen(fname, "rb");
+        if (!f) {
+            cerr << "Error opening file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        phases.open += Elapsed(Clock::now() - t);
+        return f;
+    };
+    auto closeFile = [&phases](FILE* f) {
+        const auto t = Clock::now();
+        if (fclose(f)) {
+            cerr << "Error closing file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        phases.close += Elapsed(Clock::now() - t);
+    };
+    // a shared FILE* must be locked: the file position is shared
+    const bool shared = fdMode == FdMode::Shared;
+    const bool perTransfer = fdMode == FdMode::Transfer;
+    auto readAt = [&](char* d, size_t sz, size_t off) {
+        FILE* h = perTransfer ? openFile() : f;
+        if (shared) flockfile(h);
+        if (fseek(h, off, SEEK_SET)) {
+            cerr << "Error moving file pointer (fseek): " << strerror(errno)
+                 << endl;
+            exit(EXIT_FAILURE);
+        }
+        const auto t = Clock::now();
+        if (fread(d, 1, sz, h) != sz) {
+            cerr << "Error reading from file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        const float e = Elapsed(Clock::now() - t);
+        if (shared) funlockfile(h);
+        if (perTransfer) closeFile(h);
+        return e;
+    };
+    if (fdMode == FdMode::Thread) f = openFile();
     auto start = chrono::high_resolution_clock::now();
-    if (fread(dest, 1, size, f) != size) {
-        cerr << "Error reading from file: " << strerror(errno) << endl;
-        exit(EXIT_FAILURE);
+    size_t first = 0;
+    if (timePhases) {
+        first = min(size, FIRST_BYTE_SIZE);
+        phases.firstByte = readAt(dest, first, offset);
     }
+    phases.transfer = readAt(dest + first, size - first, offset + first);
     auto end = chrono::high_resolution_clock::now();
-    if (fclose(f)) {
-        cerr << "Error closing file: " << strerror(errno) << endl;
-        exit(EXIT_FAILURE);
-    }
-    return {size, GiBs(Elapsed(end - start), size)};
-}
-
-//------------------------------------------------------------------------------
-size_t FileSize(const char* fname) {
-    struct stat st;
-    if (stat(fname, &st)) {
-        cerr << "Error retrieving file size: " << strerror(errno) << endl;
-        exit(EXIT_FAILURE);
-    }
-    return st.st_size;
+    if (fdMode == FdMode::Thread) closeFile(f);
+    ReadInfo ri{size, GiBs(Elapsed(end - start), size), offset,
+                Elapsed(end - start), phases};
+    // no read call latency: fread is not a single call to the file system
+    return ri;
 }
 
 //------------------------------------------------------------------------------
@@ -238,13 +417,37 @@ Config ParseCommandLine(int argc, char** argv) {
         it is possible to have a process read only a subregion of 
         the file. E.g.
         >read_test -p $SLURM_PROCID -N $SLURM_NUMTASKS
+        With many processes per node use a node-local layout cache to
+        have only one process per node query the file layout, e.g.
+        >srun read_test data/file -c /dev/shm/layout.cache
+        With multiple processes the read starts at the same time on all
+        processes and process 0 also prints the aggregate bandwidth,
+        per-node totals and straggler processes, see rank_barrier.h.
+        With -P the time spent in each phase (layout query, open, first
+        4 KiB, transfer, close) is reported as percentiles across all
+        the threads of all the processes, e.g. to measure open storms.
+        With -F the file is opened by each thread (default), before the
+        timed phase, once for all the threads or for each read, to compare
+        the cost of the strategies used by different I/O libraries.
+        With -T, -a and -R unbuffered reads are split into calls of a given
+        size, read in sequential or random order with the selected readahead
+        policy; -P then reports read call latency percentiles as well.
+        With -W unbuffered reads stop at a stonewall, a deadline shared by
+        all the processes or a byte budget per process, checked before each
+        read call (use -T): bandwidth is computed up to the wall and the
+        bytes read by each thread are reported; with --finish the threads
+        complete their part and the time needed is reported as well.
     )";
 
     Config cfg;
     bool showHelp = false;
     string readMode = "buffered";
+    string fdMode = "thread";
+    string access = "sequential";
+    string readahead = "default";
     auto cli =
         lyra::help(showHelp).description(HELP_TEXT) |
+        lyra::arg(cfg.fileName, "file name")("File to read").required() |
         lyra::opt(cfg.numThreads, "num threads")["-t"]["--threads"](
             "Number of concurrent threads")
             .optional() |
@@ -261,6 +464,45 @@ Config ParseCommandLine(int argc, char** argv) {
             .optional() |
         lyra::opt(cfg.perOSTBw,
                   "per OST bw")["-o"]["--per-ost-bw"]("print per-OST bandwidth")
+            .optional() |
+        lyra::opt(cfg.layoutCache, "layout cache")["-c"]["--layout-cache"](
+            "Layout cache file, filled by SLURM local process 0")
+            .optional() |
+        lyra::opt(fdMode, "fd mode")["-F"]["--fd-mode"](
+            "File descriptors: thread (opened by each thread), preopen "
+            "(per-thread, opened before the timed phase), shared (one for "
+            "all the threads), transfer (opened for each read)")
+            .choices("thread", "preopen", "shared", "transfer")
+            .optional() |
+        lyra::opt(cfg.access.transferSize,
+                  "transfer size")["-T"]["--transfer-size"](
+            "Bytes per read call, unbuffered reads only; default: whole "
+            "thread part in reads of at most 1 GiB")
+            .optional() |
+        lyra::opt(access, "access")["-a"]["--access"](
+            "Order of the read calls within each thread part: sequential, "
+            "random; unbuffered reads only")
+            .choices("sequential", "random")
+            .optional() |
+        lyra::opt(readahead, "readahead")["-R"]["--readahead"](
+            "Readahead: default (kernel), sequential, random (disabled), "
+            "noreuse (posix_fadvise), explicit (disabled, readahead() calls "
+            "issued ahead of the reads); unbuffered reads only")
+            .choices("default", "sequential", "random", "noreuse", "explicit")
+            .optional() |
+        lyra::opt(cfg.access.window, "window")["-w"]["--readahead-window"](
+            "Bytes read ahead with -R explicit, default 4 MiB")
+            .optional() |
+        lyra::opt(cfg.stonewall, "stonewall")["-W"]["--stonewall"](
+            "Stop reading at <seconds>s after the start or after <bytes> per "
+            "process; unbuffered reads only")
+            .optional() |
+        lyra::opt(cfg.finish)["--finish"](
+            "Complete the part after the stonewall, report the time needed")
+            .optional() |
+        lyra::opt(cfg.timePhases)["-P"]["--phases"](
+            "print latency percentiles of each phase across threads and "
+            "processes: layout query, open, first byte, transfer, close")
             .optional();
 
     // Parse the program arguments:
@@ -286,6 +528,42 @@ Config ParseCommandLine(int argc, char** argv) {
         cout << cli;
         exit(EXIT_FAILURE);
     }
+    ParseFdMode(fdMode, cfg.fdMode);
+    cfg.access.random = access == "random";
+    cfg.access.readahead = Readahead(
+        find(begin(READAHEAD_NAMES), end(READAHEAD_NAMES), readahead) -
+        begin(READAHEAD_NAMES));
+    if (cfg.readMode != ReadMode::Unbuffered &&
+        (cfg.access.transferSize || cfg.access.random ||
+         cfg.access.readahead != Readahead::Default)) {
+        cerr << "Transfer size, access and readahead require unbuffered reads"
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (!cfg.stonewall.empty()) {
+        Stonewall stonewall;
+        if (!stonewall.Parse(cfg.stonewall, cfg.finish)) {
+            cerr << "Invalid stonewall: " << cfg.stonewall << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (cfg.readMode != ReadMode::Unbuffered) {
+            cerr << "Stonewall requires unbuffered reads" << endl;
+            exit(EXIT_FAILURE);
+        }
+        // threads read a partial and, in random order, non contiguous range
+        if (cfg.perOSTBw) {
+            cerr << "Per-OST bandwidth not supported with stonewall" << endl;
+            exit(EXIT_FAILURE);
+        }
+    } else if (cfg.finish) {
+        cerr << "--finish requires a stonewall" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.readMode == ReadMode::MemoryMapped &&
+        cfg.fdMode != FdMode::Thread) {
+        cerr << "File descriptor mode not supported with mmap" << endl;
+        exit(EXIT_FAILURE);
+    }
 
     return cfg;
 }
@@ -295,8 +573,10 @@ Config ParseCommandLine(int argc, char** argv) {
 // filePartSize is == file size in the case of single process,
 // file size / num processes (+ file size % num processes) otherwise
 float UnbfufferedRead(const char* fname, size_t filePartSize, int nthreads,
-                      size_t globalOffset, vector<float>& threadBandwidth,
-                      size_t partFraction) {
+                      size_t globalOffset, vector<ReadInfo>& threadInfo,
+                      size_t partFraction, bool timePhases, FdMode fdMode,
+                      const Access& access, RankBarrier& barrier,
+                      Stonewall& stonewall, int64_t& endNs) {
     // NOTE: the following should return an error when opening a pre-existing
     // striped file.
     // const int fd = llapi_file_open(argv[1], flags, mode, stripeSize,
@@ -313,20 +593,46 @@ float UnbfufferedRead(const char* fname, size_t filePartSize, int nthreads,
                                     ? partSize
                                     : filePartSize % nthreads + partSize;
     vector<future<ReadInfo>> readers(nthreads);
+    // pre-opened descriptors, outside of the timed phase
+    vector<int> fds(nthreads, -1);
+    auto openFile = [fname]() {
+        const int fd = open(fname, O_RDONLY | O_LARGEFILE);
+        if (fd < 0) {
+            cerr << "Error opening file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        return fd;
+    };
+    if (fdMode == FdMode::Shared) {
+        fds.assign(nthreads, openFile());
+    } else if (fdMode == FdMode::PreOpen) {
+        for (auto& fd : fds) fd = openFile();
+    }
+    // all processes start together, after allocation and pre-open
+    barrier.Wait();
+    stonewall.Start(barrier.ReleaseNs());
     const auto start = Clock::now();
     for (int t = 0; t != nthreads; ++t) {
         const size_t offset = partSize * t;
         const size_t sz = t != nthreads - 1 ? partSize : lastPartSize;
         readers[t] = async(launch::async, ReadPartFd, fname, buffer + offset,
-                           sz / partFraction, offset + globalOffset);
+                           sz / partFraction, offset + globalOffset,
+                           timePhases, fdMode, fds[t], access,
+                           ref(stonewall));
     }
     for (auto& r : readers) r.wait();
     const auto end = Clock::now();
+    endNs = RankBarrier::Now();
+    if (fdMode == FdMode::Shared) {
+        close(fds.front());
+    } else if (fdMode == FdMode::PreOpen) {
+        for (auto fd : fds) close(fd);
+    }
     size_t totalBytesRead = 0;
     for (int r = 0; r != readers.size(); ++r) {
         const ReadInfo ri = readers[r].get();
         totalBytesRead += ri.readBytes;  // not used
-        threadBandwidth[r] = ri.bandwidth;
+        threadInfo[r] = ri;
     }
     delete[] buffer;
     return GiBs(Elapsed(end - start), filePartSize / partFraction);
@@ -336,8 +642,9 @@ float UnbfufferedRead(const char* fname, size_t filePartSize, int nthreads,
 // filePartSize is == file size in the case of single process,
 // file size / num processes (+ file size % num processes) otherwise
 float BufferedRead(const char* fname, size_t filePartSize, int nthreads,
-                   size_t globalOffset, vector<float>& threadBandwidth,
-                   size_t partFraction) {
+                   size_t globalOffset, vector<ReadInfo>& threadInfo,
+                   size_t partFraction, bool timePhases, FdMode fdMode,
+                   RankBarrier& barrier, int64_t& endNs) {
     // NOTE: the following should return an error when opening a pre-existing
     // striped file.
     // const int fd = llapi_file_open(argv[1], flags, mode, stripeSize,
@@ -354,21 +661,45 @@ float BufferedRead(const char* fname, size_t filePartSize, int nthreads,
                                     ? partSize
                                     : filePartSize % nthreads + partSize;
     vector<future<ReadInfo>> readers(nthreads);
+    // pre-opened FILE pointers, outside of the timed phase
+    vector<FILE*> files(nthreads, nullptr);
+    auto openFile = [fname]() {
+        FILE* f = fopen(fname, "rb");
+        if (!f) {
+            cerr << "Error opening file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        return f;
+    };
+    if (fdMode == FdMode::Shared) {
+        files.assign(nthreads, openFile());
+    } else if (fdMode == FdMode::PreOpen) {
+        for (auto& f : files) f = openFile();
+    }
+    // all processes start together, after allocation and pre-open
+    barrier.Wait();
     auto start = Clock::now();
     for (int t = 0; t != nthreads; ++t) {
         const size_t offset = partSize * t;
         const bool isLast = t == nthreads - 1;
         const size_t sz = isLast ? lastPartSize : partSize;
         readers[t] = async(launch::async, ReadPartFile, fname, buffer + offset,
-                           sz / partFraction, offset + globalOffset);
+                           sz / partFraction, offset + globalOffset,
+                           timePhases, fdMode, files[t]);
     }
     for (auto& r : readers) r.wait();
     const auto end = Clock::now();
+    endNs = RankBarrier::Now();
+    if (fdMode == FdMode::Shared) {
+        fclose(files.front());
+    } else if (fdMode == FdMode::PreOpen) {
+        for (auto f : files) fclose(f);
+    }
     size_t totalBytesRead = 0;
     for (int r = 0; r != readers.size(); ++r) {
         const ReadInfo ri = readers[r].get();
         totalBytesRead += ri.readBytes;  // not used
-        threadBandwidth[r] = ri.bandwidth;
+        threadInfo[r] = ri;
     }
     delete[] buffer;
     return GiBs(Elapsed(end - start), filePartSize / partFraction);
@@ -378,8 +709,9 @@ float BufferedRead(const char* fname, size_t filePartSize, int nthreads,
 // filePartSize is == file size in the case of single process,
 // file size / num processes (+ file size % num processes) otherwise
 float MMapRead(const char* fname, size_t filePartSize, int nthreads,
-               size_t globalOffset, vector<float>& threadBandwidth,
-               size_t partFraction) {
+               size_t globalOffset, vector<ReadInfo>& threadInfo,
+               size_t partFraction, bool timePhases, RankBarrier& barrier,
+               int64_t& endNs) {
     const size_t partSize = filePartSize / nthreads;
     if (partFraction > partSize || partFraction == 0) {
         cerr << "Invalid part fraction" << endl;
@@ -397,21 +729,24 @@ float MMapRead(const char* fname, size_t filePartSize, int nthreads,
         cerr << "Error locking memory (mlockall): " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
+    // all processes start together, after allocation and memory locking
+    barrier.Wait();
     const auto start = Clock::now();
     for (int t = 0; t != nthreads; ++t) {
         const size_t offset = partSize * t;
         const size_t sz = t != nthreads - 1 ? partSize : lastPartSize;
         readers[t] =
             async(launch::async, ReadPartMem, fname, buffer + offset,
-                  sz / partFraction, offset + globalOffset);
+                  sz / partFraction, offset + globalOffset, timePhases);
     }
     for (auto& r : readers) r.wait();
     const auto end = Clock::now();
+    endNs = RankBarrier::Now();
     size_t totalBytesRead = 0;
     for (int r = 0; r != readers.size(); ++r) {
         const ReadInfo ri = readers[r].get();
         totalBytesRead += ri.readBytes;  // not used
-        threadBandwidth[r] = ri.bandwidth;
+        threadInfo[r] = ri;
     }
     if (munlockall()) {
         cerr << "Error unlocking memory (mlunlockall): " << strerror(errno)
@@ -421,6 +756,47 @@ float MMapRead(const char* fname, size_t filePartSize, int nthreads,
     return GiBs(Elapsed(end - start), filePartSize / partFraction);
 }
 
+//------------------------------------------------------------------------------
+// print latency percentiles of each phase from the records gathered from all
+// the processes; layout query time is per process, read call latency per
+// call, the others per thread
+void PrintPhases(const vector<string>& records) {
+    vector<pair<string, vector<float>>> phases = {{"layout", {}},
+                                                  {"open", {}},
+                                                  {"first byte", {}},
+                                                  {"transfer", {}},
+                                                  {"close", {}},
+                                                  {"read call", {}}};
+    for (const auto& r : records) {
+        istringstream is(r);
+        float layout = 0.f;
+        if (!(is >> layout)) continue;
+        phases[0].second.push_back(layout);
+        Phases p;
+        size_t calls = 0;
+        while (is >> p.open >> p.firstByte >> p.transfer >> p.close >>
+               calls) {
+            phases[1].second.push_back(p.open);
+            phases[2].second.push_back(p.firstByte);
+            phases[3].second.push_back(p.transfer);
+            phases[4].second.push_back(p.close);
+            for (float l; calls && is >> l; --calls) {
+                phases[5].second.push_back(l);
+            }
+        }
+    }
+    cout << "Phase latency (s): count, min, 50%, 90%, 99%, max" << endl;
+    for (const auto& kv : phases) {
+        const vector<float>& v = kv.second;
+        if (v.empty()) continue;
+        cout << kv.first << ", " << v.size() << ", "
+             << *min_element(v.begin(), v.end()) << ", "
+             << Percentile(v, 50) << ", " << Percentile(v, 90) << ", "
+             << Percentile(v, 99) << ", "
+             << *max_element(v.begin(), v.end()) << endl;
+    }
+}
+
 //------------------------------------------------------------------------------
 int main(int argc, char* argv[]) {
     Config config = ParseCommandLine(argc, argv);
@@ -431,47 +807,21 @@ int main(int argc, char* argv[]) {
     const int processIndex = slurmProcId ? strtoull(slurmProcId, NULL, 10) : 0;
     const int numProcesses =
         slurmNumTasks ? strtoull(slurmNumTasks, NULL, 10) : 1;
-    // getopt will change the pointers, save data first
-    // const char* programName = argv[0];
-    const char* fileName = argv[1];
+    const char* fileName = config.fileName.c_str();
 
     const ReadMode readMode = config.readMode;
     const size_t partNum = processIndex;
     const size_t numParts = numProcesses;
 
-    llapi_layout* layout = llapi_layout_get_by_path(fileName, 0);
-
-    if (!layout) {
-        cerr << "Error retrieving layout information: " << strerror(errno)
-             << endl;
-        exit(EXIT_FAILURE);
-    }
-    // get layout attributes
-    uint64_t stripeSize = 0;
-    if (llapi_layout_stripe_size_get(layout, &stripeSize)) {
-        cerr << "Error retrieving stripe size information: " << strerror(errno)
-             << endl;
-        exit(EXIT_FAILURE);
-    }
-
-    uint64_t stripeCount = 0;
-    if (llapi_layout_stripe_count_get(layout, &stripeCount)) {
-        cerr << "Error retrieving stripe count information: " << strerror(errno)
-             << endl;
-        exit(EXIT_FAILURE);
-    }
-    vector<uint64_t> osts(stripeCount);
-    for (int i = 0; i != stripeCount; ++i) {
-        uint64_t ostIndex;
-        if (llapi_layout_ost_index_get(layout, i, &ostIndex)) {
-            cerr << "Error retrieving OST index: " << strerror(errno) << endl;
-            exit(EXIT_FAILURE);
-        }
-        osts[i] = ostIndex;
-    }
-    llapi_layout_free(layout);
-
-    const size_t fileSize = FileSize(fileName);
+    // layout and file size, through the layout cache if specified
+    const auto layoutStart = Clock::now();
+    const LayoutInfo layout = config.layoutCache.empty()
+                                  ? QueryLayout(fileName)
+                                  : CachedLayout(fileName, config.layoutCache);
+    const float layoutTime = Elapsed(Clock::now() - layoutStart);
+    const uint64_t stripeSize = layout.stripeSize;
+    uint64_t stripeCount = layout.stripeCount;
+    const size_t fileSize = layout.fileSize;
     const size_t globalOffset = partNum * fileSize / numParts;
     const size_t partSize = partNum != numParts - 1
                                 ? fileSize / numParts
@@ -498,30 +848,95 @@ int main(int argc, char* argv[]) {
              << (fileSize / config.partFraction) << " bytes "
              << (fileSize / config.partFraction) / nthreads
              << " bytes per thread" << endl;
+        if (readMode == ReadMode::Unbuffered) {
+            cout << "Access:       "
+                 << (config.access.random ? "random" : "sequential") << ", "
+                 << (config.access.transferSize
+                         ? to_string(config.access.transferSize) + " bytes"
+                         : string("whole part"))
+                 << " per read, readahead: "
+                 << READAHEAD_NAMES[int(config.access.readahead)];
+            if (config.access.readahead == Readahead::Explicit) {
+                cout << " " << config.access.window << " bytes";
+            }
+            cout << endl;
+        }
     }
 
-    vector<float> threadBandwidth(nthreads);
+    vector<ReadInfo> threadInfo(nthreads);
     float bw = 0;
+    RankBarrier barrier(RankBarrierDir(fileName));
+    Stonewall stonewall;
+    if (!config.stonewall.empty()) {
+        stonewall.Parse(config.stonewall, config.finish);
+    }
+    int64_t endNs = 0;  // end of timed phase, realtime
     switch (readMode) {
         case ReadMode::Buffered:
             cout << "Read mode: buffered" << endl;
             bw = BufferedRead(fileName, partSize, nthreads, globalOffset,
-                              threadBandwidth, config.partFraction);
+                              threadInfo, config.partFraction,
+                              config.timePhases, config.fdMode, barrier,
+                              endNs);
             break;
         case ReadMode::Unbuffered:
             cout << "Read mode: unbuffered" << endl;
             bw = UnbfufferedRead(fileName, partSize, nthreads, globalOffset,
-                                 threadBandwidth, config.partFraction);
+                                 threadInfo, config.partFraction,
+                                 config.timePhases, config.fdMode,
+                                 config.access, barrier, stonewall, endNs);
             break;
         case ReadMode::MemoryMapped:
             cout << "Read mode: memory mapped" << endl;
             bw = MMapRead(fileName, partSize, nthreads, globalOffset,
-                          threadBandwidth, config.partFraction);
+                          threadInfo, config.partFraction, config.timePhases,
+                          barrier, endNs);
             break;
         default:
             break;
     }
-    if (bw == 0) {
+    if (config.timePhases) {
+        // one record per process: layout time, then one line per thread
+        // with phases, number of read calls and call latencies
+        ostringstream os;
+        os << layoutTime << endl;
+        for (const auto& ti : threadInfo) {
+            os << ti.phases.open << " " << ti.phases.firstByte << " "
+               << ti.phases.transfer << " " << ti.phases.close << " "
+               << ti.callLatency.size();
+            for (float l : ti.callLatency) os << " " << l;
+            os << endl;
+        }
+        const vector<string> records = barrier.Gather("phases", os.str());
+        if (!records.empty()) PrintPhases(records);
+    }
+    if (!stonewall.Enabled()) {
+        barrier.Done(partSize / config.partFraction, endNs);
+    } else {
+        // bandwidth up to the wall, last thread to hit it
+        vector<StonewallResult> results;
+        for (const auto& ti : threadInfo) results.push_back(ti.wall);
+        const StonewallTotals t = Total(results);
+        const double wallTime = (t.wallNs - barrier.StartNs()) / 1E9;
+        bw = wallTime > 0 ? (t.wallBytes / double(GiB)) / wallTime : 0;
+        if (!config.bwOnly) {
+            cout << "Stonewall:    " << t.wallBytes << " bytes in "
+                 << wallTime << " s";
+            if (stonewall.Finish()) {
+                cout << ", remainder read in " << (t.endNs - t.wallNs) / 1E9
+                     << " s";
+            }
+            cout << endl;
+            for (size_t i = 0; i != results.size(); ++i) {
+                cout << "worker," << (slurmNodeId ? slurmNodeId : "0") << ","
+                     << processIndex << "," << i << ","
+                     << results[i].wallBytes << endl;
+            }
+        }
+        barrier.Done(t.wallBytes, t.wallNs);
+    }
+    // with a stonewall a process can read nothing before the wall
+    if (bw == 0 && !stonewall.Enabled()) {
         cout << "Elapsed time < 1ms " << endl;
         return 0;
     }
@@ -532,16 +947,45 @@ int main(int argc, char* argv[]) {
                              // the bandwidth number to make it easy to parse
                              // output
     if (config.perOSTBw) {
-        map<int, float> ost2bw;
-        map<float, int> bw2ost;
-        for (int i = 0; i != nthreads; ++i) {
-            ost2bw.insert({osts[i], threadBandwidth[i]});
-            bw2ost.insert({threadBandwidth[i], osts[i]});
+        // attribute bytes read by each thread to the OSTs storing them,
+        // thread time is split among OSTs proportionally to bytes
+        const int fd = open(fileName, O_RDONLY | O_LARGEFILE);
+        if (fd < 0) {
+            cerr << "Error opening file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        const ExtentMap extentMap = BuildExtentMap(fd, fileSize);
+        close(fd);
+        if (!extentMap.fiemap) {
+            cerr << "FIEMAP not available, OSTs computed from layout" << endl;
+        }
+        map<int64_t, pair<size_t, float>> ostIO;  // OST -> bytes, seconds
+        for (const auto& ti : threadInfo) {
+            if (ti.readBytes == 0) continue;
+            map<int64_t, uint64_t> ostBytes;
+            Attribute(extentMap, ti.offset, ti.readBytes, ostBytes);
+            for (const auto& kv : ostBytes) {
+                ostIO[kv.first].first += kv.second;
+                ostIO[kv.first].second +=
+                    ti.seconds * kv.second / ti.readBytes;
+            }
+        }
+        vector<float> threadBandwidth;  // per-OST bandwidth
+        multimap<float, int64_t> bw2ost;
+        for (const auto& kv : ostIO) {
+            if (kv.first == HOLE_OST) {
+                cout << "Holes: " << kv.second.first << " bytes" << endl;
+                continue;
+            }
+            const float b = GiBs(kv.second.second, kv.second.first);
+            threadBandwidth.push_back(b);
+            bw2ost.insert({b, kv.first});
         }
         for (const auto& kv : bw2ost) {
             cout << "OST " << kv.second << ": " << kv.first << " GiB/s" << endl;
         }
-        if (nthreads > 1) {
+        auto ostOf = [&bw2ost](float b) { return bw2ost.find(b)->second; };
+        if (threadBandwidth.size() > 1) {
             const float M = *max_element(std::begin(threadBandwidth),
                                          std::end(threadBandwidth));
             const float m = *min_element(std::begin(threadBandwidth),
@@ -551,18 +995,13 @@ int main(int argc, char* argv[]) {
                               threadBandwidth.size();
             const float stdev = StandardDeviation(threadBandwidth);
             const float median = Median(threadBandwidth);
-            // note: case of multiple OSTs with same bandwidth not handled,
-            // would require storing values in map as vectors instead of plain
-            // floats, if printed number of OST < total OST number it means
-            // the some OSTs have the exact same bandwidth up to the last
-            // decimal digit
             cout << "min:     " << m << " GiB/s"
-                 << " - OST " << bw2ost[m] << endl;
+                 << " - OST " << ostOf(m) << endl;
             cout << "Max:     " << M << " GiB/s"
-                 << " - OST " << bw2ost[M] << endl;
+                 << " - OST " << ostOf(M) << endl;
             cout << "Max/min: " << M / m << endl;
             cout << "Average: " << avg << " GiB/s" << endl;
-            cout << "Median:  " << median << " - OST " << bw2ost[median]
+            cout << "Median:  " << median << " - OST " << ostOf(median)
                  << endl;
             cout << "Standard deviation: " << stdev << " GiB/s" << endl;
             cout << "Standard deviation / average: " << (100 * stdev / avg)
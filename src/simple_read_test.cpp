@@ -49,11 +49,22 @@
 //   buffered: -D BUFFERED
 // execution:
 // ./simple_read_test <input file name> <num threads> <transfer size>
+//                    [<stonewall> [finish]]
+//
+// all processes start the timed phase together, see rank_barrier.h;
+// the barrier directory is created next to the file or in $RANK_BARRIER_DIR
 //
 // <transfer size> is the number of bytes read at each fread/pread call,
 // set to -1 to perform one single read operation per thread with 
 // buffer size = (file size) / ((number of processes) x (threads per process))
 //
+// <stonewall>: <seconds>s or <bytes> per process, stop reading after the
+// deadline or the byte budget, see stonewall.h; with 'finish' each thread
+// completes its part and the time to read the remainder is also reported
+//
+// FD_MODE environment variable: thread, preopen, shared or transfer, see
+// fd_mode.h
+//
 // Lustre:
 //
 // retrieve stripe count and size: lfs getstripe <file name>
@@ -97,6 +108,11 @@
 #include <future>
 #include <iostream>
 #include <numeric>
+#include <vector>
+
+#include "fd_mode.h"
+#include "rank_barrier.h"
+#include "stonewall.h"
 
 using namespace std;
 
@@ -104,42 +120,48 @@ using namespace std;
 #error "C++11 or newer required"
 #endif
 
-// The following functions write a single file part, starting at a specific
-// offset. Both buffered and unbuffered versions are implemented.
+// Buffered and unbuffered file handles: FILE* or file descriptor.
 #ifdef BUFFERED
 //------------------------------------------------------------------------------
-void ReadPart(const char* fname, char* dest, size_t size, size_t offset,
-              int64_t partSize = -1) {
+using Handle = FILE*;
+const Handle NO_HANDLE = nullptr;
+
+Handle OpenFile(const char* fname) {
     FILE* f = fopen(fname, "rb");
     if (!f) {
         cerr << "Error opening file: " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
-    partSize = partSize < 0 ? size : partSize;
-    const size_t lastPartSize = size % partSize
-                                    ? size / partSize + size % partSize
-                                    : partSize;
-    for (size_t off = 0; off < size; off += partSize) {
-        const size_t sz = off < size - partSize ? partSize : lastPartSize;
-        if (fseek(f, offset + off, SEEK_SET)) {
-            cerr << "Error moving file pointer (fseek): " << strerror(errno)
-                 << endl;
-            exit(EXIT_FAILURE);
-        }
-        if (fread(dest + off, 1, sz, f) != sz) {
-            cerr << "Error reading from file: " << strerror(errno) << endl;
-            exit(EXIT_FAILURE);
-        }
-    }
+    return f;
+}
+
+void CloseFile(Handle f) {
     if (fclose(f)) {
         cerr << "Error closing file: " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
 }
+
+// a shared FILE* must be locked: the file position is shared
+void ReadAt(Handle f, char* dest, size_t size, size_t offset, bool shared) {
+    if (shared) flockfile(f);
+    if (fseek(f, offset, SEEK_SET)) {
+        cerr << "Error moving file pointer (fseek): " << strerror(errno)
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (fread(dest, 1, size, f) != size) {
+        cerr << "Error reading from file: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (shared) funlockfile(f);
+}
 #else
 // ubuffered
-void ReadPart(const char* fname, char* dest, size_t size, size_t offset,
-              int64_t partSize = -1) {
+using Handle = int;
+const Handle NO_HANDLE = -1;
+
+Handle OpenFile(const char* fname) {
     const int flags = O_RDONLY | O_LARGEFILE;  // if supported add O_DIRECT
     const mode_t mode = 0444;                  // user, goup, all: read
     int fd = open(fname, flags, mode);
@@ -147,25 +169,49 @@ void ReadPart(const char* fname, char* dest, size_t size, size_t offset,
         cerr << "Failed to open file. Error: " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
-    partSize = partSize < 0 ? size : partSize;
-    const size_t lastPartSize = size % partSize
-                                    ? size / partSize + size % partSize
-                                    : partSize;
-    for (size_t off = 0; off < size; off += partSize) {
-        const size_t sz = off < size - partSize ? partSize : lastPartSize;
-        if (pread(fd, dest + off, size, offset + off) < 0) {
-            cerr << "Failed to read from file. Error: " << strerror(errno)
-                 << endl;
-            exit(EXIT_FAILURE);
-        }
-    }
+    return fd;
+}
+
+void CloseFile(Handle fd) {
     if (close(fd)) {
         cerr << "Error closing file " << strerror(errno) << endl;
         exit(EXIT_FAILURE);
     }
 }
+
+// pread does not use the file position: no locking required when shared
+void ReadAt(Handle fd, char* dest, size_t size, size_t offset, bool) {
+    if (pread(fd, dest, size, offset) < 0) {
+        cerr << "Failed to read from file. Error: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+}
 #endif
 
+//------------------------------------------------------------------------------
+// Read a single file part, starting at a specific offset, reading stops early
+// when the stonewall is hit.
+// 'h' is the handle opened by the caller in preopen and shared mode.
+StonewallResult ReadPart(const char* fname, char* dest, size_t size,
+                         size_t offset, int64_t partSize,
+                         Stonewall& stonewall, FdMode fdMode, Handle h) {
+    if (fdMode == FdMode::Thread) h = OpenFile(fname);
+    partSize = partSize < 0 ? size : partSize;
+    const bool shared = fdMode == FdMode::Shared;
+    const StonewallResult r =
+        stonewall.Run(size, partSize, [=](size_t off, size_t sz) {
+            if (fdMode == FdMode::Transfer) {
+                const Handle t = OpenFile(fname);
+                ReadAt(t, dest + off, sz, offset + off, false);
+                CloseFile(t);
+            } else {
+                ReadAt(h, dest + off, sz, offset + off, shared);
+            }
+        });
+    if (fdMode == FdMode::Thread) CloseFile(h);
+    return r;
+}
+
 //------------------------------------------------------------------------------
 size_t FileSize(const char* fname) {
     struct stat st;
@@ -179,7 +225,11 @@ size_t FileSize(const char* fname) {
 //------------------------------------------------------------------------------
 // Read file starting a specified global offset.
 // Global offset = process id X file size / # processes
+// per-thread results are stored into 'results', realtime end of the timed
+// phase into 'endNs'
 double Read(const char* fname, size_t size, int nthreads, size_t globalOffset,
+            RankBarrier& barrier, Stonewall& stonewall, FdMode fdMode,
+            vector<StonewallResult>& results, int64_t& endNs,
             int64_t transferSize = -1) {
 #ifdef PAGE_ALIGNED
     char* buffer = static_cast<char*>(aligned_alloc(getpagesize(), size));
@@ -192,18 +242,36 @@ double Read(const char* fname, size_t size, int nthreads, size_t globalOffset,
     const size_t partSize = size / nthreads;
     const size_t lastPartSize =
         size % nthreads == 0 ? partSize : size % nthreads + partSize;
-    future<void> readers[nthreads];
+    vector<future<StonewallResult>> readers(nthreads);
+    // pre-opened handles, outside of the timed phase
+    vector<Handle> handles(nthreads, NO_HANDLE);
+    if (fdMode == FdMode::Shared) {
+        handles.assign(nthreads, OpenFile(fname));
+    } else if (fdMode == FdMode::PreOpen) {
+        for (auto& h : handles) h = OpenFile(fname);
+    }
     using Clock = chrono::high_resolution_clock;
+    // all processes start together
+    barrier.Wait();
+    stonewall.Start(barrier.ReleaseNs());
     auto start = Clock::now();
     for (int t = 0; t != nthreads; ++t) {
         const size_t offset = partSize * t;
         const bool isLast = t == nthreads - 1;
         const size_t sz = isLast ? lastPartSize : partSize;
         readers[t] = async(launch::async, ReadPart, fname, buffer + offset, sz,
-                           offset + globalOffset, transferSize);
+                           offset + globalOffset, transferSize, ref(stonewall),
+                           fdMode, handles[t]);
     }
-    for (auto& r : readers) r.wait();
+    results.clear();
+    for (auto& r : readers) results.push_back(r.get());
     const auto end = Clock::now();
+    endNs = Stonewall::Now();
+    if (fdMode == FdMode::Shared) {
+        CloseFile(handles.front());
+    } else if (fdMode == FdMode::PreOpen) {
+        for (auto h : handles) CloseFile(h);
+    }
     free(buffer);
     return double(chrono::duration_cast<chrono::nanoseconds>(end - start)
                       .count()) /
@@ -212,17 +280,35 @@ double Read(const char* fname, size_t size, int nthreads, size_t globalOffset,
 
 //-----------------------------------------------------------------------------
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
+    if (argc < 4 || argc > 6) {
         cerr << "Usage: " << argv[0]
              << " <file name> <number of threads per process> <transfer size>"
+                " [<stonewall> [finish]]"
              << endl
              << " set transfer size to -1 to use default per thread buffer size"
              << endl
+             << " stonewall: <seconds>s or <bytes> per process, stop after "
+                "deadline or byte budget; with finish also report the time "
+                "to read the remainder"
+             << endl
              << " SLURM required: it will "
                 "distribute the computation across all processes automatically"
              << endl
              << " CSV output format: node id, process id, bandwidth (GiB/s), "
-                "time (s)"
+                "time (s), start delay (s)"
+             << endl
+             << " with stonewall bandwidth and time are computed up to the "
+                "wall, followed by bytes read before the wall, time to "
+                "finish (s); plus one line per thread: worker, node id, "
+                "process id, thread id, bytes read before the wall"
+             << endl
+             << " FD_MODE=thread|preopen|shared|transfer: per-thread "
+                "descriptor opened in the timed phase (default), per-thread "
+                "or shared descriptor opened before the timed phase, "
+                "descriptor opened for each transfer, see fd_mode.h"
+             << endl
+             << " process 0 also prints aggregate, per-node and straggler "
+                "lines, see rank_barrier.h"
              << endl;
         exit(EXIT_FAILURE);
     }
@@ -233,11 +319,28 @@ int main(int argc, char* argv[]) {
         cerr << "Error, invalid number of threads" << endl;
         exit(EXIT_FAILURE);
     }
-    const int64_t transferSize = strtoll(argv[2], NULL, 10);
+    const int64_t transferSize = strtoll(argv[3], NULL, 10);
     if (transferSize == 0) {
         cerr << "Error, wrong transfer buffer size" << endl;
         exit(EXIT_FAILURE);
     }
+    FdMode fdMode;
+    if (!FdModeFromEnv(fdMode)) {
+        cerr << "Error, invalid FD_MODE" << endl;
+        exit(EXIT_FAILURE);
+    }
+    Stonewall stonewall;
+    if (argc > 4) {
+        const bool finish = argc == 6 && string(argv[5]) == "finish";
+        if (!stonewall.Parse(argv[4], finish) || (argc == 6 && !finish)) {
+            cerr << "Error, invalid stonewall" << endl;
+            exit(EXIT_FAILURE);
+        }
+        if (transferSize < 0) {
+            cerr << "Error, stonewall requires a transfer size" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
     const char* slurmProcId = getenv("SLURM_PROCID");
     const char* slurmNumTasks = getenv("SLURM_NTASKS");
     const char* slurmNodeId = getenv("SLURM_NODEID");
@@ -252,12 +355,35 @@ int main(int argc, char* argv[]) {
             ? fileSize / numProcesses
             : fileSize / numProcesses + fileSize % numProcesses;
     const size_t globalOffset = processIndex * partSize;
+    RankBarrier barrier(RankBarrierDir(fileName));
+    vector<StonewallResult> results;
+    int64_t endNs = 0;
     const double elapsed =
-        Read(fileName, partSize, nthreads, globalOffset, transferSize);
+        Read(fileName, partSize, nthreads, globalOffset, barrier, stonewall,
+             fdMode, results, endNs, transferSize);
     const double GiB = 1 << 30;
-    const double GiBs = (partSize / GiB) / elapsed;
-    if (slurmNodeId)
-        cout << slurmNodeId << "," << processIndex << "," << GiBs << ","
-             << elapsed << endl;
+    if (!stonewall.Enabled()) {
+        const double GiBs = (partSize / GiB) / elapsed;
+        if (slurmNodeId)
+            cout << slurmNodeId << "," << processIndex << "," << GiBs << ","
+                 << elapsed << "," << barrier.StartDelay() << endl;
+        barrier.Done(partSize, endNs);
+        return 0;
+    }
+    const StonewallTotals t = Total(results);
+    const double wallTime = (t.wallNs - barrier.StartNs()) / 1E9;
+    const double finishTime =
+        stonewall.Finish() ? (t.endNs - t.wallNs) / 1E9 : 0;
+    if (slurmNodeId) {
+        cout << slurmNodeId << "," << processIndex << ","
+             << (t.wallBytes / GiB) / wallTime << "," << wallTime << ","
+             << barrier.StartDelay() << "," << t.wallBytes << ","
+             << finishTime << endl;
+        for (size_t i = 0; i != results.size(); ++i) {
+            cout << "worker," << slurmNodeId << "," << processIndex << ","
+                 << i << "," << results[i].wallBytes << endl;
+        }
+    }
+    barrier.Done(t.wallBytes, t.wallNs);
     return 0;
 }
\ No newline at end of file
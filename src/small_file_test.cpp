@@ -0,0 +1,383 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Small file workload: generate a directory of files with sizes drawn from
+// a uniform or log-uniform distribution, optionally with a Data-on-MDT first
+// component, then read them back with a pool of threads. Reports files/s,
+// MiB/s and the open/read/close latency split.
+// Run without arguments to read help text.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <lustre/lustreapi.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <lyra/lyra.hpp>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "stats.h"
+
+using namespace std;
+
+// Data-on-MDT layout pattern, Lustre >= 2.11; older libraries reject it
+#ifndef LLAPI_LAYOUT_MDT
+#define LLAPI_LAYOUT_MDT 2ULL
+#endif
+
+// constants
+const uint32_t MiB = 1 << 20;
+constexpr float us = 1E6;
+
+// default clock
+using Clock = chrono::high_resolution_clock;
+
+// Compute elapsed time
+constexpr float Elapsed(const chrono::duration<float>& d) {
+    return chrono::duration_cast<chrono::microseconds>(d).count() / us;
+}
+
+// Configuration information read from command line
+struct Config {
+    string dir;                     // file directory
+    size_t numFiles = 10000;        // number of files
+    size_t minSize = 4096;          // minimum file size
+    size_t maxSize = 65536;         // maximum file size
+    bool logUniform = false;        // log-uniform instead of uniform sizes
+    size_t domSize = 0;             // size of DoM component, 0 = no DoM
+    int numThreads = 1;             // number of threads
+    bool create = true;             // generate files
+    bool read = true;               // read files
+    unsigned seed = 1;              // random seed for file sizes
+};
+
+// per-thread read result
+struct ReadInfo {
+    size_t files = 0;
+    size_t bytes = 0;
+    vector<float> open;   // latency in us
+    vector<float> read;
+    vector<float> close;
+};
+
+//------------------------------------------------------------------------------
+Config ParseCommandLine(int argc, char** argv) {
+    static const char* HELP_TEXT = R"(
+        Small file benchmark: create a number of files with sizes between
+        min and max in the target directory then read them back with a
+        pool of threads. With -D the first <bytes> of each file are stored
+        on the MDT (Data-on-MDT, Lustre >= 2.11) and the rest on a single
+        OST. Files are never overwritten: creating a file which already
+        exists is an error. With -m read the files already present in the
+        directory are read, allowing the same set of files to be read from
+        many nodes.
+        E.g.
+        >small_file_test /scratch/tmp/small -n 100000 -s 4096 -S 65536 \
+            -D 65536 -t 16
+    )";
+    Config cfg;
+    bool showHelp = false;
+    string mode = "both";
+    string distribution = "uniform";
+    auto cli =
+        lyra::help(showHelp).description(HELP_TEXT) |
+        lyra::arg(cfg.dir, "directory")("File directory").required() |
+        lyra::opt(cfg.numFiles, "files")["-n"]["--files"]("Number of files")
+            .optional() |
+        lyra::opt(cfg.minSize, "min size")["-s"]["--min-size"](
+            "Minimum file size")
+            .optional() |
+        lyra::opt(cfg.maxSize, "max size")["-S"]["--max-size"](
+            "Maximum file size")
+            .optional() |
+        lyra::opt(distribution, "distribution")["-d"]["--distribution"](
+            "File size distribution")
+            .choices("uniform", "log-uniform")
+            .optional() |
+        lyra::opt(cfg.domSize, "DoM size")["-D"]["--dom"](
+            "Size of Data-on-MDT component, multiple of 64 KiB")
+            .optional() |
+        lyra::opt(cfg.numThreads, "threads")["-t"]["--threads"](
+            "Number of threads")
+            .optional() |
+        lyra::opt(mode, "mode")["-m"]["--mode"](
+            "create: generate files, read: read existing files, both")
+            .choices("create", "read", "both")
+            .optional() |
+        lyra::opt(cfg.seed, "seed")["--seed"]("Random seed for file sizes")
+            .optional();
+
+    auto result = cli.parse({argc, argv});
+    if (!result) {
+        cerr << result.errorMessage() << endl;
+        cerr << cli << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (showHelp) {
+        cout << cli;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.numThreads < 1 || cfg.numFiles == 0) {
+        cerr << "Number of threads and files must be greater than zero"
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.minSize == 0 || cfg.minSize > cfg.maxSize) {
+        cerr << "Invalid file size range" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (cfg.domSize % (64 << 10)) {
+        cerr << "DoM size must be a multiple of 64 KiB" << endl;
+        exit(EXIT_FAILURE);
+    }
+    cfg.logUniform = distribution == "log-uniform";
+    cfg.create = mode != "read";
+    cfg.read = mode != "create";
+    return cfg;
+}
+
+//------------------------------------------------------------------------------
+// file sizes, same seed -> same sizes
+vector<size_t> FileSizes(const Config& config) {
+    mt19937_64 gen(config.seed);
+    vector<size_t> sizes(config.numFiles);
+    if (config.logUniform) {
+        uniform_real_distribution<double> d(log(double(config.minSize)),
+                                            log(double(config.maxSize)));
+        for (auto& s : sizes) s = size_t(round(exp(d(gen))));
+    } else {
+        uniform_int_distribution<size_t> d(config.minSize, config.maxSize);
+        for (auto& s : sizes) s = d(gen);
+    }
+    return sizes;
+}
+
+string SmallFileName(const string& dir, size_t i) {
+    return dir + "/sf." + to_string(i);
+}
+
+// two component layout: [0, domSize) on MDT, [domSize, EOF) on one OST
+llapi_layout* DoMLayout(size_t domSize) {
+    llapi_layout* layout = llapi_layout_alloc();
+    if (!layout || llapi_layout_pattern_set(layout, LLAPI_LAYOUT_MDT) ||
+        llapi_layout_stripe_size_set(layout, domSize) ||
+        llapi_layout_comp_extent_set(layout, 0, domSize) ||
+        llapi_layout_comp_add(layout) ||
+        llapi_layout_comp_extent_set(layout, domSize, LUSTRE_EOF) ||
+        llapi_layout_stripe_count_set(layout, 1)) {
+        cerr << "Error setting DoM layout: " << strerror(errno) << endl;
+        exit(EXIT_FAILURE);
+    }
+    return layout;
+}
+
+// create files [first, last)
+void CreateFiles(const Config& config, const vector<size_t>& sizes,
+                 size_t first, size_t last) {
+    llapi_layout* layout =
+        config.domSize ? DoMLayout(config.domSize) : nullptr;
+    vector<char> buffer(config.maxSize, 'x');
+    for (size_t i = first; i != last; ++i) {
+        const string fname = SmallFileName(config.dir, i);
+        // O_EXCL in both cases: llapi_layout_file_create cannot set the
+        // layout of an existing file
+        const int fd =
+            layout ? llapi_layout_file_create(
+                         fname.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644,
+                         layout)
+                   : open(fname.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            cerr << "Cannot create file " << fname << ": " << strerror(errno)
+                 << endl;
+            if (errno == EEXIST) {
+                cerr << "Files are created in an empty directory, use -m read "
+                        "to read existing files"
+                     << endl;
+            }
+            exit(EXIT_FAILURE);
+        }
+        if (write(fd, buffer.data(), sizes[i]) != ssize_t(sizes[i])) {
+            cerr << "Error writing to file " << fname << ": "
+                 << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        // drop cached pages so that the read phase hits the servers
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        if (close(fd)) {
+            cerr << "Error closing file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (layout) llapi_layout_free(layout);
+}
+
+// file names in directory, used when reading existing files
+vector<string> ListFiles(const string& dir) {
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        cerr << "Cannot open directory " << dir << ": " << strerror(errno)
+             << endl;
+        exit(EXIT_FAILURE);
+    }
+    vector<string> files;
+    while (dirent* e = readdir(d)) {
+        if (e->d_type != DT_REG && e->d_type != DT_UNKNOWN) continue;
+        if (e->d_name[0] == '.') continue;
+        files.push_back(dir + "/" + e->d_name);
+    }
+    closedir(d);
+    return files;
+}
+
+//------------------------------------------------------------------------------
+// threads pick the next file from a shared counter so that a slow file
+// does not hold back the other threads
+ReadInfo ReadFiles(const vector<string>& files, atomic<size_t>& next,
+                   size_t bufferSize) {
+    ReadInfo ri;
+    vector<char> buffer(bufferSize);
+    for (size_t i = next++; i < files.size(); i = next++) {
+        const auto t0 = Clock::now();
+        const int fd = open(files[i].c_str(), O_RDONLY);
+        if (fd < 0) {
+            cerr << "Error opening file " << files[i] << ": "
+                 << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        const auto t1 = Clock::now();
+        ssize_t b = 0;
+        while ((b = read(fd, buffer.data(), buffer.size())) > 0) ri.bytes += b;
+        if (b < 0) {
+            cerr << "Error reading from file " << files[i] << ": "
+                 << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        const auto t2 = Clock::now();
+        if (close(fd)) {
+            cerr << "Error closing file: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        const auto t3 = Clock::now();
+        ri.open.push_back(us * Elapsed(t1 - t0));
+        ri.read.push_back(us * Elapsed(t2 - t1));
+        ri.close.push_back(us * Elapsed(t3 - t2));
+        ++ri.files;
+    }
+    return ri;
+}
+
+void PrintLatency(const string& name, const vector<float>& l) {
+    cout << setw(8) << name << setw(10) << Percentile(l, 50) << setw(10)
+         << Percentile(l, 90) << setw(10) << Percentile(l, 99) << setw(10)
+         << (l.empty() ? 0.f : *max_element(begin(l), end(l))) << endl;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char* argv[]) {
+    const Config config = ParseCommandLine(argc, argv);
+    cout << fixed << setprecision(1);
+    if (config.create) {
+        if (mkdir(config.dir.c_str(), 0755) && errno != EEXIST) {
+            cerr << "Cannot create directory " << config.dir << ": "
+                 << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        const vector<size_t> sizes = FileSizes(config);
+        const size_t perThread = config.numFiles / config.numThreads;
+        const size_t remainder = config.numFiles % config.numThreads;
+        vector<future<void>> writers(config.numThreads);
+        const auto start = Clock::now();
+        size_t first = 0;
+        for (int t = 0; t != config.numThreads; ++t) {
+            const size_t last = first + perThread + (size_t(t) < remainder ? 1 : 0);
+            writers[t] = async(launch::async, CreateFiles, cref(config),
+                               cref(sizes), first, last);
+            first = last;
+        }
+        for (auto& w : writers) w.get();
+        const float seconds = Elapsed(Clock::now() - start);
+        size_t bytes = 0;
+        for (auto s : sizes) bytes += s;
+        cout << "Created " << config.numFiles << " files, "
+             << float(bytes) / MiB << " MiB"
+             << (config.domSize ? ", Data-on-MDT" : "") << endl;
+        cout << "Create: " << config.numFiles / seconds << " files/s, "
+             << bytes / seconds / MiB << " MiB/s" << endl;
+    }
+    if (!config.read) return 0;
+    const vector<string> files = ListFiles(config.dir);
+    atomic<size_t> next(0);
+    vector<future<ReadInfo>> readers(config.numThreads);
+    const auto start = Clock::now();
+    for (auto& r : readers) {
+        r = async(launch::async, ReadFiles, cref(files), ref(next),
+                  config.maxSize);
+    }
+    ReadInfo total;
+    for (auto& r : readers) {
+        const ReadInfo ri = r.get();
+        total.files += ri.files;
+        total.bytes += ri.bytes;
+        total.open.insert(end(total.open), begin(ri.open), end(ri.open));
+        total.read.insert(end(total.read), begin(ri.read), end(ri.read));
+        total.close.insert(end(total.close), begin(ri.close), end(ri.close));
+    }
+    const float seconds = Elapsed(Clock::now() - start);
+    cout << "Read " << total.files << " files, " << float(total.bytes) / MiB
+         << " MiB" << endl;
+    cout << "Read: " << total.files / seconds << " files/s, "
+         << total.bytes / seconds / MiB << " MiB/s" << endl
+         << endl;
+    cout << "Latency in us" << endl;
+    cout << setw(8) << "" << setw(10) << "p50" << setw(10) << "p90"
+         << setw(10) << "p99" << setw(10) << "max" << endl;
+    PrintLatency("open", total.open);
+    PrintLatency("read", total.read);
+    PrintLatency("close", total.close);
+    return 0;
+}
@@ -0,0 +1,81 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Statistics on sequences of measurements: used to summarise per-thread,
+// per-OST and per-operation timings.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <numeric>
+
+// standard deviation
+template <typename SeqT>
+typename SeqT::value_type StandardDeviation(const SeqT& seq) {
+    using Value = typename SeqT::value_type;
+    const typename SeqT::size_type N = seq.size();
+    if (N == 0) return Value(0);
+    const Value sum =
+        std::accumulate(std::cbegin(seq), std::cend(seq), Value(0));
+    const Value avg = sum / N;
+    Value variance(0);
+    for (const auto& v : seq) variance += (v - avg) * (v - avg) / N;
+    return std::sqrt(variance);
+}
+
+// p-th percentile, p in [0, 100], nearest rank
+template <typename SeqT>
+typename SeqT::value_type Percentile(SeqT seq, double p) {
+    using Value = typename SeqT::value_type;
+    if (seq.empty()) return Value(0);
+    const size_t rank =
+        std::min(seq.size() - 1, size_t(std::ceil(p / 100. * seq.size())) -
+                                     (p > 0 ? 1 : 0));
+    std::nth_element(std::begin(seq), std::begin(seq) + rank, std::end(seq));
+    return seq[rank];
+}
+
+// median
+template <typename SeqT>
+typename SeqT::value_type Median(SeqT seq) {
+    if (seq.empty()) return typename SeqT::value_type(0);
+    std::nth_element(std::begin(seq), std::begin(seq) + seq.size() / 2,
+                     std::end(seq));
+    return seq[seq.size() / 2];
+}
@@ -0,0 +1,159 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Stonewalling for the simple read/write tests, as in IOR: workers transfer
+// chunks until a deadline shared by all the processes, or until the bytes
+// moved by the process reach a budget, and then stop; with static
+// partitioning the run would otherwise last as long as the slowest OST or
+// process and the bandwidth measured would be dominated by the tail.
+// The deadline is relative to the barrier release time (realtime clock),
+// which is the same on all processes, see rank_barrier.h.
+// With 'finish' the workers complete their part after the wall is hit, and
+// the time needed to transfer the remainder is reported as well.
+//
+// Specification: <seconds>s (deadline) or <bytes> (per-process budget)
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// bytes and time of one worker
+struct StonewallResult {
+    size_t wallBytes = 0;  // bytes transferred before the wall
+    int64_t wallNs = 0;    // time the wall was hit or the part completed
+    size_t bytes = 0;      // bytes transferred, including the remainder
+    int64_t endNs = 0;
+};
+
+class Stonewall {
+   public:
+    Stonewall() = default;  // disabled
+    // returns false if the specification is invalid
+    bool Parse(const std::string& spec, bool finish) {
+        char* end = nullptr;
+        if (!spec.empty() && spec.back() == 's') {
+            const double s = strtod(spec.c_str(), &end);
+            if (end != &spec.back() || s <= 0) return false;
+            seconds_ = s;
+        } else {
+            const unsigned long long b = strtoull(spec.c_str(), &end, 10);
+            if (spec.empty() || *end || b == 0) return false;
+            budget_ = b;
+        }
+        finish_ = finish;
+        return true;
+    }
+    bool Enabled() const { return seconds_ > 0 || budget_ > 0; }
+    bool Finish() const { return finish_; }
+    // start of the timed phase, realtime ns since epoch
+    void Start(int64_t startNs) {
+        if (seconds_ > 0) deadlineNs_ = startNs + int64_t(seconds_ * 1E9);
+    }
+    // true if the worker must not start a new transfer
+    bool Hit() const {
+        return (deadlineNs_ && Now() >= deadlineNs_) ||
+               (budget_ && bytes_ >= budget_);
+    }
+    // charge transferred bytes to the budget, for transfer loops other than
+    // Run; only bytes transferred before the wall must be charged
+    void Add(size_t bytes) {
+        if (budget_) bytes_ += bytes;
+    }
+    // transfer loop: calls transfer(offset, size) on consecutive chunks of
+    // 'size' bytes until the part is complete or the wall is hit
+    template <typename TransferT>
+    StonewallResult Run(size_t size, size_t chunkSize,
+                        TransferT transfer) {
+        StonewallResult r;
+        bool hit = false;
+        for (size_t off = 0; off < size; off += chunkSize) {
+            if (!hit && Enabled() && Hit()) {
+                hit = true;
+                r.wallBytes = r.bytes;
+                r.wallNs = Now();
+                if (!finish_) break;
+            }
+            const size_t sz = std::min(chunkSize, size - off);
+            transfer(off, sz);
+            r.bytes += sz;
+            if (!hit) Add(sz);
+        }
+        r.endNs = Now();
+        if (!hit) {
+            r.wallBytes = r.bytes;
+            r.wallNs = r.endNs;
+        }
+        return r;
+    }
+    static int64_t Now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::system_clock::now().time_since_epoch())
+            .count();
+    }
+
+   private:
+    double seconds_ = 0;
+    size_t budget_ = 0;
+    bool finish_ = false;
+    int64_t deadlineNs_ = 0;
+    std::atomic<size_t> bytes_{0};  // all the workers of this process
+};
+
+// process totals
+struct StonewallTotals {
+    size_t wallBytes = 0;
+    int64_t wallNs = 0;  // last worker to hit the wall
+    size_t bytes = 0;
+    int64_t endNs = 0;
+};
+
+inline StonewallTotals Total(const std::vector<StonewallResult>& results) {
+    StonewallTotals t;
+    for (const auto& r : results) {
+        t.wallBytes += r.wallBytes;
+        t.wallNs = std::max(t.wallNs, r.wallNs);
+        t.bytes += r.bytes;
+        t.endNs = std::max(t.endNs, r.endNs);
+    }
+    return t;
+}
@@ -0,0 +1,114 @@
+/*******************************************************************************
+ * BSD 3-Clause License
+ *
+ * Copyright (c) 2020, Commonwealth Scientific and Industrial Research
+ * Organisation (CSIRO) and The Pawsey Supercomputing Centre
+ *
+ * Author: Ugo Varetto
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ * this list of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its
+ *    contributors may be used to endorse or promote products derived from
+ *    this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ ******************************************************************************/
+
+// Extent map test: a two component PFL file whose components reuse the same
+// OSTs is described by synthetic FIEMAP extents with the stripe number
+// packed in fe_device; bytes attributed to each OST must match the layout.
+// Returns non-zero on failure.
+
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#include "../src/extent_map.h"
+
+using namespace std;
+
+const uint64_t MiB = 1 << 20;
+
+int main(int, char**) {
+    // [0, 4 MiB): OSTs 3, 5; [4 MiB, EOF): OSTs 5, 7, 3
+    vector<Component> comps(2);
+    comps[0].start = 0;
+    comps[0].end = 4 * MiB;
+    comps[0].stripeSize = MiB;
+    comps[0].osts = {3, 5};
+    comps[1].start = 4 * MiB;
+    comps[1].end = LUSTRE_EOF;
+    comps[1].stripeSize = MiB;
+    comps[1].osts = {5, 7, 3};
+    const uint64_t fileSize = 10 * MiB;
+
+    // one extent per stripe unit, object offset from the RAID0 mapping
+    ExtentMap em;
+    map<int64_t, uint64_t> expected;
+    uint64_t firstStripe = 0;  // absolute number of first component stripe
+    for (const auto& c : comps) {
+        const uint64_t S = c.stripeSize;
+        const uint64_t C = c.osts.size();
+        for (uint64_t f = c.start; f < min(c.end, fileSize); f += S) {
+            const uint64_t stripe = (f / S) % C;
+            fiemap_extent x = {};
+            x.fe_logical = (f / (S * C)) * S + f % S;
+            x.fe_length = S;
+            x.fe_device = ((firstStripe + stripe) << 16) | c.osts[stripe];
+            InsertFiemapExtent(em, comps, x);
+            expected[c.osts[stripe]] += S;
+        }
+        firstStripe += C;
+    }
+
+    map<int64_t, uint64_t> ostBytes;
+    Attribute(em, 0, fileSize, ostBytes);
+    int errors = 0;
+    if (ostBytes != expected) {
+        cerr << "Per-OST bytes do not match the layout:" << endl;
+        for (const auto& kv : ostBytes) {
+            const auto e = expected.find(kv.first);
+            cerr << "  OST " << kv.first << ": " << kv.second << " expected "
+                 << (e == expected.end() ? 0 : e->second) << endl;
+        }
+        ++errors;
+    }
+    // OST 3: stripe 0 of the first component and stripe 2 of the second
+    const map<int64_t, uint64_t> totals = {
+        {3, 4 * MiB}, {5, 4 * MiB}, {7, 2 * MiB}};
+    if (expected != totals) {
+        cerr << "Unexpected test layout" << endl;
+        ++errors;
+    }
+    // a single range on the second component stripe of OST 3
+    ostBytes.clear();
+    Attribute(em, 5 * MiB, MiB, ostBytes);
+    if (ostBytes.size() != 1 || ostBytes[3] != MiB) {
+        cerr << "Range [5, 6) MiB not attributed to OST 3" << endl;
+        ++errors;
+    }
+    if (!errors) cout << "extent_map_test: OK" << endl;
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}